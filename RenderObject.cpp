@@ -3,25 +3,17 @@
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/euler_angles.hpp>
+#include <glm/gtc/packing.hpp>
 
+#include <algorithm>
 #include <iostream>
 using namespace std;
 
 #include "shapes.h"
+#include "profiler.h"
 
 using namespace glm;
 
-mat4 Transform::getMatrix()
-{
-    mat4 model = mat4(1.0f);
-    model = glm::scale(model, scale);
-    model = rotate(model, radians(rotation.x), vec3(1, 0, 0));
-    model = rotate(model, radians(rotation.y), vec3(0, 1, 0));
-    model = rotate(model, radians(rotation.z), vec3(0, 0, 1));
-    translate(model, position);
-    return model;
-}
-
 Camera::Camera(vec3 position, vec3 target, float near, float far, int width, int height, float fov)
 {
     this->position = position;
@@ -70,67 +62,164 @@ void VertexAttribute::set() const
         pointer);
 }
 
-SpheresRenderer::SpheresRenderer(GLuint shaderID, std::vector<Transform> &transforms, std::vector<vec3> &colors, int subdivisions)
-    : transforms(transforms), shaderID(shaderID), colors(colors)
+PersistentBuffer::PersistentBuffer(GLsizeiptr regionSize, int regionCount)
+    : regionSize(regionSize), regionCount(regionCount), region(regionCount - 1), fences(regionCount, (GLsync)0)
 {
-    IndexedMesh sphere = make_icosphere(subdivisions);
-    vertexCount = sphere.first.size();
-    triangleCount = sphere.second.size();
-    transformCount = transforms.size();
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &bufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, bufferID);
+    glBufferStorage(GL_ARRAY_BUFFER, regionSize * regionCount, nullptr, flags);
+    mapped = (char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, regionSize * regionCount, flags);
+}
 
-    glGenBuffers(1, &vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(vec3), &sphere.first[0], GL_STATIC_DRAW);
+PersistentBuffer::~PersistentBuffer()
+{
+    for (GLsync sync : fences)
+    {
+        if (sync)
+            glDeleteSync(sync);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, bufferID);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glDeleteBuffers(1, &bufferID);
+}
 
-    glGenBuffers(1, &triangleBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, triangleBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, triangleCount * sizeof(Triangle), &sphere.second[0], GL_STATIC_DRAW);
+void *PersistentBuffer::nextRegion()
+{
+    SPH_PROFILE_SCOPE("buffer wait");
+    region = (region + 1) % regionCount;
+    GLsync sync = fences[region];
+    if (sync)
+    {
+        // normally signaled long ago, only waits if the GPU is more than regionCount - 1 frames behind
+        while (glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+        {
+        }
+        glDeleteSync(sync);
+        fences[region] = 0;
+    }
+    return mapped + region * regionSize;
+}
 
-    glGenBuffers(1, &transformsBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, transformsBuffer);
+void PersistentBuffer::fence()
+{
+    if (fences[region])
+        glDeleteSync(fences[region]);
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
 
-    glGenBuffers(1, &colorsBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, colorsBuffer);
+ParticleRenderer::ParticleRenderer(GLuint shaderID, int maxInstances, vec3 boundsMin, vec3 boundsMax)
+    : shaderID(shaderID), boundsMin(boundsMin), boundsMax(boundsMax), maxInstances(maxInstances),
+      instanceBuffer(maxInstances * sizeof(ParticleInstance))
+{
+    GLint previousVertexArray;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+    glGenVertexArrays(1, &vertexArray);
+    glBindVertexArray(vertexArray);
 
     vMatrixID = glGetUniformLocation(shaderID, "view");
     pMatrixID = glGetUniformLocation(shaderID, "projection");
     lightPositionID = glGetUniformLocation(shaderID, "lightDir");
-    positionsAttribute = BufferAttribute(transformsBuffer, glGetAttribLocation(shaderID, "position"), 3, GL_FLOAT, GL_FALSE, sizeof(Transform), (void *)0, 1);
-    rotationsAttribute = BufferAttribute(transformsBuffer, glGetAttribLocation(shaderID, "rotation"), 3, GL_FLOAT, GL_FALSE, sizeof(Transform), (void *)(sizeof(vec3)), 1);
-    scalesAttribute = BufferAttribute(transformsBuffer, glGetAttribLocation(shaderID, "scale"), 3, GL_FLOAT, GL_FALSE, sizeof(Transform), (void *)(2 * sizeof(vec3)), 1);
-    colorsAttribute = BufferAttribute(colorsBuffer, glGetAttribLocation(shaderID, "color"), 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void *)0, 1);
-    vertexAttribute = VertexAttribute(glGetAttribLocation(shaderID, "vertex"), 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+    boundsMinID = glGetUniformLocation(shaderID, "boundsMin");
+    boundsSizeID = glGetUniformLocation(shaderID, "boundsSize");
+    radiusID = glGetUniformLocation(shaderID, "radius");
+    valueRangeID = glGetUniformLocation(shaderID, "valueRange");
+    BufferAttribute(instanceBuffer.bufferID, glGetAttribLocation(shaderID, "position"), 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(ParticleInstance), (void *)0, 1).set();
+    BufferAttribute(instanceBuffer.bufferID, glGetAttribLocation(shaderID, "value"), 1, GL_HALF_FLOAT, GL_FALSE, sizeof(ParticleInstance), (void *)(3 * sizeof(GLushort)), 1).set();
+
+    glBindVertexArray(previousVertexArray);
+}
+
+ParticleRenderer::~ParticleRenderer()
+{
+    glDeleteVertexArrays(1, &vertexArray);
+}
+
+ParticleInstance *ParticleRenderer::mapInstances()
+{
+    return (ParticleInstance *)instanceBuffer.nextRegion();
 }
 
-void SpheresRenderer::draw()
+ParticleInstance ParticleRenderer::makeInstance(vec3 position, float value) const
 {
+    vec3 normalized = clamp((position - boundsMin) / (boundsMax - boundsMin), vec3(0), vec3(1));
+    ParticleInstance instance;
+    instance.position[0] = (GLushort)(normalized.x * 65535 + 0.5f);
+    instance.position[1] = (GLushort)(normalized.y * 65535 + 0.5f);
+    instance.position[2] = (GLushort)(normalized.z * 65535 + 0.5f);
+    instance.value = packHalf1x16(value);
+    return instance;
+}
+
+void ParticleRenderer::draw(int instanceCount, float radius, float valueMin, float valueMax)
+{
+    SPH_PROFILE_SCOPE("particle draw");
+    GLint previousVertexArray;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
     glUseProgram(shaderID);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, triangleBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    vertexAttribute.set();
+    glBindVertexArray(vertexArray);
 
     mat4 view = Camera::mainCamera.getViewMatrix();
     glUniformMatrix4fv(vMatrixID, 1, GL_FALSE, &view[0][0]);
     mat4 projection = Camera::mainCamera.getProjectionMatrix();
     glUniformMatrix4fv(pMatrixID, 1, GL_FALSE, &projection[0][0]);
-
     vec3 lightDir(1, 0, 0);
-
     glUniform3fv(lightPositionID, 1, &lightDir[0]);
+    vec3 boundsSize = boundsMax - boundsMin;
+    glUniform3fv(boundsMinID, 1, &boundsMin[0]);
+    glUniform3fv(boundsSizeID, 1, &boundsSize[0]);
+    glUniform1f(radiusID, radius);
+    glUniform2f(valueRangeID, valueMin, valueMax);
+
+    drawInstances(std::min(instanceCount, maxInstances), instanceBuffer.currentRegion() * maxInstances);
+    instanceBuffer.fence();
+
+    glBindVertexArray(previousVertexArray);
+}
+
+ParticleSpheresRenderer::ParticleSpheresRenderer(GLuint shaderID, int maxInstances, vec3 boundsMin, vec3 boundsMax, int subdivisions)
+    : ParticleRenderer(shaderID, maxInstances, boundsMin, boundsMax)
+{
+    IndexedMesh sphere = make_icosphere(subdivisions);
+    vertexCount = sphere.first.size();
+    triangleCount = sphere.second.size();
+
+    GLint previousVertexArray;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+    glBindVertexArray(vertexArray);
 
-    glBindBuffer(GL_ARRAY_BUFFER, transformsBuffer);
-    glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(Transform), &transforms[0], GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(vec3), &sphere.first[0], GL_STATIC_DRAW);
+    VertexAttribute(glGetAttribLocation(shaderID, "vertex"), 3, GL_FLOAT, GL_FALSE, 0, (void *)0).set();
+
+    glGenBuffers(1, &triangleBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, triangleBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, triangleCount * sizeof(Triangle), &sphere.second[0], GL_STATIC_DRAW);
+
+    glBindVertexArray(previousVertexArray);
+}
 
-    positionsAttribute.set();
-    rotationsAttribute.set();
-    scalesAttribute.set();
+ParticleSpheresRenderer::~ParticleSpheresRenderer()
+{
+    glDeleteBuffers(1, &vertexBuffer);
+    glDeleteBuffers(1, &triangleBuffer);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, colorsBuffer);
-    glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(vec3), &colors[0], GL_DYNAMIC_DRAW);
+void ParticleSpheresRenderer::drawInstances(GLsizei instanceCount, GLuint baseInstance)
+{
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, triangleCount * 3, GL_UNSIGNED_INT, (void *)0, instanceCount, baseInstance);
+}
 
-    colorsAttribute.set();
+ParticleImpostorRenderer::ParticleImpostorRenderer(GLuint shaderID, int maxInstances, vec3 boundsMin, vec3 boundsMax)
+    : ParticleRenderer(shaderID, maxInstances, boundsMin, boundsMax)
+{
+}
 
-    glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)triangleCount * 3, GL_UNSIGNED_INT, (void *)0, transforms.size());
+void ParticleImpostorRenderer::drawInstances(GLsizei instanceCount, GLuint baseInstance)
+{
+    // the quad corners come from gl_VertexID, only the instance attributes are read from buffers
+    glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, instanceCount, baseInstance);
 }
 
 RenderObject::RenderObject(GLuint shaderID, GLsizei vertexCount, std::vector<BufferAttribute> vertexAttributes, vec3 position, vec3 rotation, vec3 scale)
@@ -4,14 +4,7 @@
 
 #include <glm/glm.hpp>
 
-struct Transform
-{
-    glm::vec3 position;
-    glm::vec3 rotation; // euler angles in degrees
-    glm::vec3 scale;
-    Transform(glm::vec3 position = glm::vec3(0), glm::vec3 rotation = glm::vec3(0), glm::vec3 scale = glm::vec3(1)) : position(position), rotation(rotation), scale(scale){};
-    glm::mat4 getMatrix();
-};
+#include "transform.h"
 
 struct BufferAttribute
 {
@@ -55,31 +48,115 @@ public:
     glm::mat4 getProjectionMatrix();
 };
 
-class SpheresRenderer
+/*
+Immutable buffer that stays persistently and coherently mapped, split into regionCount
+regions that are written round robin. A fence placed after the draw that reads a region
+guards it until the GPU is done, so writing never stalls on a reallocation or copy.
+*/
+class PersistentBuffer
+{
+public:
+    GLuint bufferID;
+    GLsizeiptr regionSize;
+    int regionCount;
+    PersistentBuffer(GLsizeiptr regionSize, int regionCount = 3);
+    ~PersistentBuffer();
+    PersistentBuffer(const PersistentBuffer &) = delete;
+    PersistentBuffer &operator=(const PersistentBuffer &) = delete;
+    /*
+    Move on to the next region and wait until the GPU no longer reads it, returns its mapped memory.
+    The memory is write-combined: write it sequentially and never read from it.
+    */
+    void *nextRegion();
+    // index of the region returned by the last nextRegion call
+    int currentRegion() const { return region; }
+    // call after the draw call that reads the current region
+    void fence();
+
+private:
+    char *mapped;
+    int region;
+    std::vector<GLsync> fences;
+};
+
+/*
+Compact per particle instance, 8 bytes instead of a 36 byte Transform and a 12 byte color.
+The position is quantized to 16 bits per axis over the bounds of the renderer,
+value (density or speed) is a half float that the shader maps to a color.
+*/
+struct ParticleInstance
+{
+    GLushort position[3];
+    GLushort value;
+};
+
+/*
+Base of the renderers that draw particles from ParticleInstance data, owns the instance
+buffer and the uniforms shared by the shaders/particles and shaders/impostor shaders
+*/
+class ParticleRenderer
 {
 public:
     GLuint shaderID;
-    SpheresRenderer(GLuint shaderID, std::vector<Transform> &transforms, std::vector<glm::vec3> &colors, int subdivisions = 1);
-    void draw();
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    ParticleRenderer(GLuint shaderID, int maxInstances, glm::vec3 boundsMin, glm::vec3 boundsMax);
+    virtual ~ParticleRenderer();
+    /*
+    Instance data of the next frame, write up to maxInstances instances directly into the mapped buffer
+    */
+    ParticleInstance *mapInstances();
+    int capacity() const { return maxInstances; }
+    ParticleInstance makeInstance(glm::vec3 position, float value) const;
+    /*
+    Draw spheres of the given radius, values from valueMin to valueMax span the colormap
+    */
+    void draw(int instanceCount, float radius, float valueMin, float valueMax);
+
+protected:
+    GLuint vertexArray;
+    int maxInstances;
+    GLuint vMatrixID;
+    GLuint pMatrixID;
+    GLuint lightPositionID;
+    GLuint boundsMinID;
+    GLuint boundsSizeID;
+    GLuint radiusID;
+    GLuint valueRangeID;
+    PersistentBuffer instanceBuffer;
+    // issue the draw call, the vertex array and uniforms are already set
+    virtual void drawInstances(GLsizei instanceCount, GLuint baseInstance) = 0;
+};
+
+/*
+Draws every particle as an icosphere mesh, expects the shaders/particles shader
+*/
+class ParticleSpheresRenderer : public ParticleRenderer
+{
+public:
+    ParticleSpheresRenderer(GLuint shaderID, int maxInstances, glm::vec3 boundsMin, glm::vec3 boundsMax, int subdivisions = 1);
+    ~ParticleSpheresRenderer();
 
 protected:
     GLuint vertexBuffer;
     GLuint triangleBuffer;
-    GLuint transformsBuffer;
-    GLuint colorsBuffer;
     GLsizei triangleCount;
     GLsizei vertexCount;
-    GLsizei transformCount;
-    GLuint vMatrixID;
-    GLuint pMatrixID;
-    GLuint lightPositionID;
-    std::vector<Transform> &transforms;
-    std::vector<glm::vec3> &colors;
-    BufferAttribute positionsAttribute;
-    BufferAttribute rotationsAttribute;
-    BufferAttribute scalesAttribute;
-    BufferAttribute colorsAttribute;
-    VertexAttribute vertexAttribute;
+    void drawInstances(GLsizei instanceCount, GLuint baseInstance) override;
+};
+
+/*
+Draws every particle as a camera facing quad and ray casts the sphere per fragment,
+expects the shaders/impostor shader. Four vertices per particle at any zoom,
+the spheres are exact and write their true depth.
+*/
+class ParticleImpostorRenderer : public ParticleRenderer
+{
+public:
+    ParticleImpostorRenderer(GLuint shaderID, int maxInstances, glm::vec3 boundsMin, glm::vec3 boundsMax);
+
+protected:
+    void drawInstances(GLsizei instanceCount, GLuint baseInstance) override;
 };
 
 class RenderObject
@@ -0,0 +1,656 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "fluid.h"
+#include "grid.h"
+#include "kernel.h"
+#include "particles.h"
+#include "threadPool.h"
+#ifdef SPH_BENCH_SHAPES
+#include "shapes.h"
+#endif
+
+using namespace glm;
+using namespace std;
+
+/*
+Microbenchmarks of the grid, the kernel, the solver step and the mesh generation.
+Every case runs with a growing iteration count until one run takes the minimum time,
+the reported time per iteration is taken from that run.
+*/
+
+// keeps the compiler from dropping a result that is never used
+template <typename T>
+static void doNotOptimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+class BenchmarkState
+{
+public:
+    int64_t iterations;
+    BenchmarkState(int64_t iterations) { this->iterations = iterations; }
+    // for (auto _ : state) style loop, while (state.keepRunning())
+    bool keepRunning()
+    {
+        if (done == 0)
+            start = chrono::steady_clock::now();
+        if (done < iterations)
+        {
+            done++;
+            return true;
+        }
+        elapsed += chrono::steady_clock::now() - start;
+        return false;
+    }
+    // items handled by one iteration, reported as items per second
+    void setItemsPerIteration(double items) { itemsPerIteration = items; }
+    double seconds() const { return chrono::duration<double>(elapsed).count(); }
+    double itemsPerIteration = 0;
+    // reported as they are, e.g. average neighbor counts
+    map<string, double> counters;
+
+private:
+    int64_t done = 0;
+    chrono::steady_clock::time_point start;
+    chrono::steady_clock::duration elapsed = chrono::steady_clock::duration::zero();
+};
+
+struct Benchmark
+{
+    string name;
+    // runs before every repetition, e.g. to build the particle set
+    function<void()> setUp;
+    function<void(BenchmarkState &)> run;
+    function<void()> tearDown;
+};
+
+struct BenchmarkResult
+{
+    string name;
+    string aggregate;
+    int64_t iterations;
+    double nsPerIteration;
+    double itemsPerSecond;
+    map<string, double> counters;
+};
+
+static vector<Benchmark> benchmarks;
+
+static void addBenchmark(const string &name, function<void(BenchmarkState &)> run, function<void()> setUp = nullptr, function<void()> tearDown = nullptr)
+{
+    benchmarks.push_back({name, setUp, run, tearDown});
+}
+
+static BenchmarkResult runBenchmark(const Benchmark &benchmark, double minTime)
+{
+    int64_t iterations = 1;
+    while (true)
+    {
+        BenchmarkState state(iterations);
+        benchmark.run(state);
+        double seconds = state.seconds();
+        // grow towards the minimum time, at most 10x per round and at least 2x
+        if (seconds >= minTime || iterations >= (int64_t)1 << 40)
+        {
+            BenchmarkResult result;
+            result.name = benchmark.name;
+            result.iterations = iterations;
+            result.nsPerIteration = seconds * 1e9 / iterations;
+            result.itemsPerSecond = state.itemsPerIteration > 0 ? state.itemsPerIteration * iterations / seconds : 0;
+            result.counters = state.counters;
+            return result;
+        }
+        double scale = seconds > 0 ? minTime * 1.4 / seconds : 10;
+        iterations = max(iterations * 2, (int64_t)ceil(iterations * min(scale, 10.0)));
+    }
+}
+
+// mean, median and stddev over the repetitions of one benchmark
+static vector<BenchmarkResult> aggregate(const vector<BenchmarkResult> &runs)
+{
+    vector<double> times;
+    for (const BenchmarkResult &run : runs)
+        times.push_back(run.nsPerIteration);
+    double mean = 0;
+    for (double t : times)
+        mean += t / times.size();
+    double variance = 0;
+    for (double t : times)
+        variance += (t - mean) * (t - mean) / max((int)times.size() - 1, 1);
+    sort(times.begin(), times.end());
+    size_t half = times.size() / 2;
+    double median = times.size() % 2 ? times[half] : (times[half - 1] + times[half]) / 2;
+
+    vector<BenchmarkResult> results;
+    const char *names[] = {"mean", "median", "stddev"};
+    double values[] = {mean, median, sqrt(variance)};
+    for (int i = 0; i < 3; i++)
+    {
+        BenchmarkResult result = runs[0];
+        result.aggregate = names[i];
+        result.nsPerIteration = values[i];
+        // throughput of the aggregated time, none for the deviation
+        double items = runs[0].itemsPerSecond * runs[0].nsPerIteration;
+        result.itemsPerSecond = i < 2 && values[i] > 0 ? items / values[i] : 0;
+        results.push_back(result);
+    }
+    return results;
+}
+
+enum class Distribution
+{
+    // uniform in the unit block the solver starts from
+    Block,
+    // settled layer at the bottom of the [-1, 1]^3 domain
+    Pool,
+    // pool with a fifth of the particles sprayed over the whole domain
+    Splash
+};
+
+static const char *distributionName(Distribution distribution)
+{
+    switch (distribution)
+    {
+    case Distribution::Pool:
+        return "pool";
+    case Distribution::Splash:
+        return "splash";
+    default:
+        return "block";
+    }
+}
+
+/*
+Smoothing length that keeps the neighbor count of the default 1000 particle block,
+so every particle count measures the same amount of work per particle
+*/
+static float smoothingLength(int n)
+{
+    return FluidParameters().h * cbrt(1000.0f / n);
+}
+
+static void fillParticles(Particles &particles, int n, Distribution distribution)
+{
+    particles.resize(n);
+    mt19937 random(12345);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int sprayed = distribution == Distribution::Splash ? n / 5 : 0;
+    for (int i = 0; i < n; i++)
+    {
+        vec3 u(unit(random), unit(random), unit(random));
+        vec3 p;
+        if (distribution == Distribution::Block)
+            p = u - vec3(0.5f);
+        else if (i < n - sprayed)
+        {
+            // the unit block spread over the 2 x 2 floor is a quarter high
+            p = vec3(2 * u.x - 1, u.y * 0.25f - 1, 2 * u.z - 1);
+        }
+        else
+            p = u * 2.0f - vec3(1);
+        particles.setPosition(i, p);
+        particles.setVelocity(i, vec3(0));
+    }
+}
+
+static unique_ptr<Grid> makeGrid(int n, int tableSize, const Particles &particles)
+{
+    // the cell size the solver uses, 4h plus the neighbor list skin
+    float h = smoothingLength(n);
+    float cellSize = 4 * h + FluidParameters().skin * h / FluidParameters().h;
+    if (tableSize > 0)
+        return make_unique<HashGrid>(cellSize, tableSize, particles);
+    return make_unique<DenseGrid>(cellSize, vec3(-1), vec3(1), particles);
+}
+
+static string gridName(int tableSize)
+{
+    return tableSize > 0 ? "hash/table:" + to_string(tableSize) : "dense";
+}
+
+// state shared by the grid benchmarks of one configuration
+struct GridFixture
+{
+    Particles particles;
+    unique_ptr<Grid> grid;
+    vector<vec3> queries;
+};
+
+static void addGridBenchmarks(ThreadPool &pool, int n, Distribution distribution, int tableSize)
+{
+    auto fixture = make_shared<GridFixture>();
+    auto setUp = [fixture, &pool, n, distribution, tableSize]()
+    {
+        fillParticles(fixture->particles, n, distribution);
+        fixture->grid = makeGrid(n, tableSize, fixture->particles);
+        fixture->grid->update(pool);
+        // query at particle positions, in a random order like a scattered access pattern would
+        mt19937 random(54321);
+        uniform_int_distribution<int> index(0, n - 1);
+        fixture->queries.resize(1024);
+        for (vec3 &query : fixture->queries)
+            query = fixture->particles.position(index(random));
+    };
+    auto tearDown = [fixture]()
+    {
+        fixture->grid.reset();
+        fixture->particles.resize(0);
+    };
+    string suffix = string("/") + distributionName(distribution) + "/n:" + to_string(n) + "/" + gridName(tableSize);
+
+    addBenchmark(
+        "grid_update" + suffix, [fixture, &pool, n](BenchmarkState &state)
+        {
+            while (state.keepRunning())
+                fixture->grid->update(pool);
+            state.setItemsPerIteration(n); },
+        setUp, tearDown);
+
+    addBenchmark(
+        "grid_for_each_neighbor" + suffix, [fixture](BenchmarkState &state)
+        {
+            int64_t found = 0;
+            while (state.keepRunning())
+            {
+                for (vec3 query : fixture->queries)
+                    fixture->grid->forEachNeighbor(query, [&](int)
+                                                   { found++; });
+            }
+            doNotOptimize(found);
+            state.setItemsPerIteration((double)fixture->queries.size());
+            state.counters["neighbors"] = (double)found / (state.iterations * fixture->queries.size()); },
+        setUp, tearDown);
+
+    addBenchmark(
+        "grid_get_neighbors" + suffix, [fixture](BenchmarkState &state)
+        {
+            int64_t found = 0;
+            while (state.keepRunning())
+            {
+                for (vec3 query : fixture->queries)
+                    found += fixture->grid->getNeighbors(query).size();
+            }
+            doNotOptimize(found);
+            state.setItemsPerIteration((double)fixture->queries.size());
+            state.counters["neighbors"] = (double)found / (state.iterations * fixture->queries.size()); },
+        setUp, tearDown);
+
+    addBenchmark(
+        "grid_get_cell" + suffix, [fixture](BenchmarkState &state)
+        {
+            int64_t found = 0;
+            while (state.keepRunning())
+            {
+                for (vec3 query : fixture->queries)
+                    found += fixture->grid->getCell(query).size();
+            }
+            doNotOptimize(found);
+            state.setItemsPerIteration((double)fixture->queries.size());
+            state.counters["cell"] = (double)found / (state.iterations * fixture->queries.size()); },
+        setUp, tearDown);
+}
+
+static void addKernelBenchmarks()
+{
+    // distances spread over the whole support, about a third of them outside like in a neighbor list
+    const int count = 4096;
+    auto distances = make_shared<vector<float>>(count);
+    auto gradients = make_shared<vector<float>>(count);
+    Kernel kernel(FluidParameters().h);
+    mt19937 random(777);
+    uniform_real_distribution<float> r(0.0f, 6 * kernel.h);
+    for (float &d : *distances)
+        d = r(random);
+
+    addBenchmark("kernel_w", [distances, kernel](BenchmarkState &state)
+                 {
+        float sum = 0;
+        while (state.keepRunning())
+        {
+            for (float d : *distances)
+                sum += kernel.W(d);
+            doNotOptimize(sum);
+        }
+        state.setItemsPerIteration(count); });
+
+    addBenchmark("kernel_dw", [distances, kernel](BenchmarkState &state)
+                 {
+        float sum = 0;
+        while (state.keepRunning())
+        {
+            for (float d : *distances)
+                sum += kernel.dW(d);
+            doNotOptimize(sum);
+        }
+        state.setItemsPerIteration(count); });
+
+    // every instruction set the cpu supports, setIsa clamps the rest to the same one
+    KernelIsa supported = Kernel::isa();
+    KernelIsa isas[] = {KernelIsa::Scalar, KernelIsa::SSE, KernelIsa::AVX2, KernelIsa::AVX512};
+    for (KernelIsa isa : isas)
+    {
+        if (isa > supported)
+            break;
+        Kernel::setIsa(isa);
+        string name = string("kernel_sum_w_and_gradients/") + Kernel::isaName();
+        auto select = [isa]()
+        { Kernel::setIsa(isa); };
+        auto restore = [supported]()
+        { Kernel::setIsa(supported); };
+        addBenchmark(
+            name, [distances, gradients, kernel](BenchmarkState &state)
+            {
+                float sum = 0;
+                while (state.keepRunning())
+                {
+                    sum += kernel.sumWAndGradients(distances->data(), gradients->data(), count);
+                    doNotOptimize(sum);
+                }
+                state.setItemsPerIteration(count); },
+            select, restore);
+    }
+    Kernel::setIsa(supported);
+}
+
+static void addStepBenchmark(int n, int tableSize, int threads, PressureSolver solver)
+{
+    auto fluid = make_shared<unique_ptr<Fluid>>();
+    auto setUp = [fluid, n, tableSize, threads, solver]()
+    {
+        // the solver only starts from a block, scaled like the grid benchmarks
+        FluidParameters parameters;
+        parameters.setParticleCount(n);
+        parameters.gridType = tableSize > 0 ? GridType::Hash : GridType::Dense;
+        if (tableSize > 0)
+            parameters.tableSize = tableSize;
+        parameters.threads = threads;
+        parameters.pressureSolver = solver;
+        *fluid = make_unique<Fluid>(parameters);
+        // past the first neighbor list build
+        (*fluid)->step();
+    };
+    auto tearDown = [fluid]()
+    { fluid->reset(); };
+    addBenchmark(
+        "fluid_step/block/n:" + to_string(n) + "/" + gridName(tableSize) + (solver == PressureSolver::Implicit ? "/iisph" : ""), [fluid](BenchmarkState &state)
+        {
+            Fluid &instance = **fluid;
+            int builds = instance.neighborListBuilds();
+            while (state.keepRunning())
+                instance.step();
+            state.setItemsPerIteration(instance.particleCount());
+            state.counters["rebuilds_per_step"] = (double)(instance.neighborListBuilds() - builds) / state.iterations;
+            if (instance.getPressureSolver() == PressureSolver::Implicit)
+                state.counters["solver_iterations"] = instance.getSolverIterations(); },
+        setUp, tearDown);
+}
+
+#ifdef SPH_BENCH_SHAPES
+static void addIcosphereBenchmarks()
+{
+    for (int subdivisions = 0; subdivisions <= 4; subdivisions++)
+    {
+        addBenchmark("make_icosphere/subdivisions:" + to_string(subdivisions), [subdivisions](BenchmarkState &state)
+                     {
+            size_t triangles = 0;
+            while (state.keepRunning())
+            {
+                IndexedMesh mesh = make_icosphere(subdivisions);
+                triangles = mesh.second.size();
+                doNotOptimize(triangles);
+            }
+            state.setItemsPerIteration((double)triangles);
+            state.counters["triangles"] = (double)triangles; });
+    }
+}
+#endif
+
+static void printUsage(const char *program)
+{
+    cout << "usage: " << program << " [options]\n"
+         << "  --filter REGEX     only run benchmarks whose name matches\n"
+         << "  --list             print the benchmark names and exit\n"
+         << "  --min-time S       minimum time of the measured run (default 0.5)\n"
+         << "  --repetitions N    measure every benchmark N times and report mean, median and stddev\n"
+         << "  --max-particles N  largest particle count, powers of ten from 1e3 (default 1e6, up to 1e7)\n"
+         << "  --table-sizes A,B  hash grid table sizes (default 1000,10000,100000,1000000)\n"
+         << "  --threads N        worker threads (default: all hardware threads)\n"
+         << "  --json PATH        write the results as JSON\n";
+}
+
+static vector<int> parseList(const string &text)
+{
+    vector<int> values;
+    stringstream stream(text);
+    string item;
+    while (getline(stream, item, ','))
+        values.push_back((int)atof(item.c_str()));
+    return values;
+}
+
+static string jsonEscape(const string &text)
+{
+    string escaped;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+static bool writeJson(const string &path, const vector<BenchmarkResult> &results, int threads, double minTime)
+{
+    ofstream file(path);
+    if (!file)
+    {
+        cerr << "cannot write " << path << endl;
+        return false;
+    }
+    char date[64];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    file << setprecision(10);
+    file << "{\n  \"context\": {\n"
+         << "    \"date\": \"" << date << "\",\n"
+         << "    \"num_cpus\": " << thread::hardware_concurrency() << ",\n"
+         << "    \"threads\": " << threads << ",\n"
+         << "    \"kernel_isa\": \"" << Kernel::isaName() << "\",\n"
+         << "    \"min_time\": " << minTime << "\n"
+         << "  },\n  \"benchmarks\": [";
+    const char *separator = "\n";
+    for (const BenchmarkResult &result : results)
+    {
+        string name = result.aggregate.empty() ? result.name : result.name + "_" + result.aggregate;
+        file << separator << "    {\"name\": \"" << jsonEscape(name) << "\", "
+             << "\"run_name\": \"" << jsonEscape(result.name) << "\", "
+             << "\"run_type\": \"" << (result.aggregate.empty() ? "iteration" : "aggregate") << "\", ";
+        if (!result.aggregate.empty())
+            file << "\"aggregate_name\": \"" << result.aggregate << "\", ";
+        file << "\"iterations\": " << result.iterations << ", "
+             << "\"real_time\": " << result.nsPerIteration << ", "
+             << "\"time_unit\": \"ns\"";
+        if (result.itemsPerSecond > 0)
+            file << ", \"items_per_second\": " << result.itemsPerSecond;
+        for (const auto &counter : result.counters)
+            file << ", \"" << jsonEscape(counter.first) << "\": " << counter.second;
+        file << "}";
+        separator = ",\n";
+    }
+    file << "\n  ]\n}\n";
+    return (bool)file;
+}
+
+static void printResult(const BenchmarkResult &result)
+{
+    string name = result.aggregate.empty() ? result.name : result.name + "_" + result.aggregate;
+    cout << left << setw(64) << name << right << setw(14) << fixed << setprecision(0) << result.nsPerIteration << " ns"
+         << setw(12) << result.iterations;
+    if (result.itemsPerSecond > 0)
+        cout << setw(12) << setprecision(3) << result.itemsPerSecond * 1e-6 << " M/s";
+    for (const auto &counter : result.counters)
+        cout << "  " << counter.first << "=" << setprecision(2) << counter.second;
+    cout << endl;
+}
+
+int main(int argc, char **argv)
+{
+    string filter;
+    bool list = false;
+    double minTime = 0.5;
+    int repetitions = 1;
+    int maxParticles = 1000000;
+    vector<int> tableSizes = {1000, 10000, 100000, 1000000};
+    int threads = 0;
+    string jsonPath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        auto value = [&]() -> const char *
+        {
+            if (i + 1 >= argc)
+            {
+                cerr << "missing value for " << arg << endl;
+                exit(1);
+            }
+            return argv[++i];
+        };
+        if (arg == "--filter")
+            filter = value();
+        else if (arg == "--list")
+            list = true;
+        else if (arg == "--min-time")
+            minTime = atof(value());
+        else if (arg == "--repetitions")
+            repetitions = max(atoi(value()), 1);
+        else if (arg == "--max-particles")
+            maxParticles = (int)atof(value());
+        else if (arg == "--table-sizes")
+            tableSizes = parseList(value());
+        else if (arg == "--threads")
+            threads = atoi(value());
+        else if (arg == "--json")
+            jsonPath = value();
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            cerr << "unknown option " << arg << endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    ThreadPool pool(threads);
+    vector<int> counts;
+    for (int n = 1000; n <= maxParticles && n <= 10000000; n *= 10)
+        counts.push_back(n);
+    vector<int> grids = {0};
+    grids.insert(grids.end(), tableSizes.begin(), tableSizes.end());
+
+    addKernelBenchmarks();
+#ifdef SPH_BENCH_SHAPES
+    addIcosphereBenchmarks();
+#endif
+    for (int n : counts)
+    {
+        for (Distribution distribution : {Distribution::Block, Distribution::Pool, Distribution::Splash})
+        {
+            for (int tableSize : grids)
+                addGridBenchmarks(pool, n, distribution, tableSize);
+        }
+    }
+    for (int n : counts)
+    {
+        for (int tableSize : grids)
+        {
+            addStepBenchmark(n, tableSize, pool.size(), PressureSolver::EquationOfState);
+            addStepBenchmark(n, tableSize, pool.size(), PressureSolver::Implicit);
+        }
+    }
+
+    regex pattern;
+    try
+    {
+        pattern = regex(filter);
+    }
+    catch (const regex_error &)
+    {
+        cerr << "invalid filter " << filter << endl;
+        return 1;
+    }
+    vector<const Benchmark *> selected;
+    for (const Benchmark &benchmark : benchmarks)
+    {
+        if (filter.empty() || regex_search(benchmark.name, pattern))
+            selected.push_back(&benchmark);
+    }
+    if (list)
+    {
+        for (const Benchmark *benchmark : selected)
+            cout << benchmark->name << endl;
+        return 0;
+    }
+
+    cout << "threads: " << pool.size() << endl;
+    cout << "kernel: " << Kernel::isaName() << endl;
+    cout << left << setw(64) << "benchmark" << right << setw(17) << "time" << setw(12) << "iterations" << setw(16) << "items" << endl;
+    vector<BenchmarkResult> results;
+    for (const Benchmark *benchmark : selected)
+    {
+        vector<BenchmarkResult> runs;
+        for (int r = 0; r < repetitions; r++)
+        {
+            // every repetition starts from the same state, the solver moves on with each step
+            if (benchmark->setUp)
+                benchmark->setUp();
+            runs.push_back(runBenchmark(*benchmark, minTime));
+            printResult(runs.back());
+            if (benchmark->tearDown)
+                benchmark->tearDown();
+        }
+        results.insert(results.end(), runs.begin(), runs.end());
+        if (repetitions > 1)
+        {
+            for (const BenchmarkResult &result : aggregate(runs))
+            {
+                printResult(result);
+                results.push_back(result);
+            }
+        }
+    }
+    if (!jsonPath.empty() && !writeJson(jsonPath, results, pool.size(), minTime))
+        return 1;
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#include "cellActivity.h"
+
+using namespace std;
+
+CellActivity::CellActivity(int sleepSteps) : sleepingBuckets(0), sleeping(0)
+{
+    this->sleepSteps = sleepSteps > 0 ? sleepSteps : INT_MAX;
+}
+
+void CellActivity::resize(int buckets)
+{
+    if ((int)quietSteps.size() == buckets)
+        return;
+    quietSteps.assign(buckets, 0);
+    restless.assign(buckets, 0);
+    wake = make_unique<atomic<bool>[]>(buckets);
+    for (int b = 0; b < buckets; b++)
+        wake[b] = false;
+    sleepingBuckets = 0;
+    sleeping = 0;
+}
+
+void CellActivity::endStep(const Grid &grid)
+{
+    for (int b = 0; b < (int)quietSteps.size(); b++)
+    {
+        if (asleep(b))
+        {
+            if (wake[b].load(memory_order_relaxed))
+                quietSteps[b] = 0;
+        }
+        else if (restless[b] || grid.bucketSize(b) == 0)
+            quietSteps[b] = 0;
+        else
+            quietSteps[b]++;
+        restless[b] = 0;
+        wake[b].store(false, memory_order_relaxed);
+    }
+    count(grid);
+}
+
+void CellActivity::count(const Grid &grid)
+{
+    sleepingBuckets = 0;
+    sleeping = 0;
+    for (int b = 0; b < (int)quietSteps.size(); b++)
+    {
+        if (asleep(b))
+        {
+            sleepingBuckets++;
+            sleeping += grid.bucketSize(b);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+#include <climits>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "grid.h"
+
+/*
+Sleep state of the grid buckets, which are the cells of the dense grid.
+A bucket falls asleep once none of its particles was restless for sleepSteps steps in a row
+and wakes as soon as a restless particle has one of its particles in its neighbor row,
+so a disturbance wakes every bucket within the kernel support plus the skin.
+Buckets keep their index across grid updates and so does their state.
+Restless marks may only come from the task that owns the bucket, wake requests from any thread.
+*/
+class CellActivity
+{
+public:
+    // 0 never sleeps
+    CellActivity(int sleepSteps = 0);
+    // sleepSteps <= 0 is kept as INT_MAX, which no bucket reaches
+    bool enabled() const { return sleepSteps != INT_MAX; }
+    // keeps the state if the bucket count doesn't change
+    void resize(int buckets);
+    int bucketCount() const { return (int)quietSteps.size(); }
+    bool asleep(int bucket) const { return quietSteps[bucket] >= sleepSteps; }
+    bool anyAsleep() const { return sleepingBuckets > 0; }
+    void markRestless(int bucket) { restless[bucket] = 1; }
+    void requestWake(int bucket) { wake[bucket].store(true, std::memory_order_relaxed); }
+    /*
+    After the last pass of a step: wake the requested buckets, count quiet steps, put buckets to sleep.
+    Empty buckets never sleep, a particle moving into one stays awake.
+    */
+    void endStep(const Grid &grid);
+    int sleepingParticles() const { return sleeping; }
+    // steps bucket has been quiet, kept by checkpoints
+    int quiet(int bucket) const { return quietSteps[bucket]; }
+    void setQuiet(int bucket, int steps) { quietSteps[bucket] = steps; }
+    // recount after setQuiet
+    void count(const Grid &grid);
+
+private:
+    int sleepSteps;
+    std::vector<int> quietSteps;
+    std::vector<unsigned char> restless;
+    std::unique_ptr<std::atomic<bool>[]> wake;
+    int sleepingBuckets;
+    int sleeping;
+};
\ No newline at end of file
@@ -0,0 +1,473 @@
+#include "checkpoint.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <new>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const uint32_t byteOrderMark = 0x01020304;
+
+// the particle arrays that make up the state, in file order. A file without a required one is rejected,
+// the others are recomputed by the next step and start at zero if missing
+static const struct
+{
+    const char *name;
+    AlignedArray<float> Particles::*array;
+    bool required;
+} particleArrays[] = {
+    {"x", &Particles::x, true},
+    {"y", &Particles::y, true},
+    {"z", &Particles::z, true},
+    {"vx", &Particles::vx, true},
+    {"vy", &Particles::vy, true},
+    {"vz", &Particles::vz, true},
+    {"ax", &Particles::ax, false},
+    {"ay", &Particles::ay, false},
+    {"az", &Particles::az, false},
+    {"density", &Particles::density, false},
+    {"pressure", &Particles::pressure, false},
+};
+constexpr int particleArrayCount = sizeof(particleArrays) / sizeof(particleArrays[0]);
+// int32 ids of the particles, which the solver keeps in grid order. Files without them are in creation order
+static const char *idArray = "id";
+// positions at the last neighbor list build. Rebuilding the list from them on load gives the same
+// rows as the saved run, which keeps the row sums, and so a restarted run, bit identical to an uninterrupted one
+static const char *referenceArrays[3] = {"x0", "y0", "z0"};
+// int32 quiet steps of the cell of every particle at that build, so sleeping cells stay asleep
+static const char *quietArray = "quiet";
+constexpr int maxSectionCount = particleArrayCount + 5;
+static_assert(sizeof(CheckpointHeader) + maxSectionCount * sizeof(CheckpointSection) <= checkpointAlignment, "header and section table must fit in the first block");
+
+static uint64_t alignUp(uint64_t size)
+{
+    return (size + checkpointAlignment - 1) / checkpointAlignment * checkpointAlignment;
+}
+
+static void storeParameters(CheckpointHeader &header, const FluidParameters &parameters)
+{
+    header.nx = parameters.nx;
+    header.ny = parameters.ny;
+    header.nz = parameters.nz;
+    header.dt = parameters.dt;
+    header.adaptiveTimeStep = parameters.adaptiveTimeStep;
+    header.cfl = parameters.cfl;
+    header.forceFactor = parameters.forceFactor;
+    header.minDt = parameters.minDt;
+    header.simulatedVolume = parameters.simulatedVolume;
+    header.gravity = parameters.gravity;
+    header.restDensity = parameters.restDensity;
+    header.h = parameters.h;
+    header.stiffness = parameters.stiffness;
+    header.damping = parameters.damping;
+    header.m = parameters.m;
+    header.mu = parameters.mu;
+    header.gridType = (int32_t)parameters.gridType;
+    header.tableSize = parameters.tableSize;
+    header.skin = parameters.skin;
+    header.pressureSolver = (int32_t)parameters.pressureSolver;
+    header.solverIterations = parameters.solverIterations;
+    header.densityTolerance = parameters.densityTolerance;
+    header.relaxation = parameters.relaxation;
+    header.sleepSteps = parameters.sleepSteps;
+    header.sleepSpeed = parameters.sleepSpeed;
+    header.sleepDensityChange = parameters.sleepDensityChange;
+}
+
+static void loadParameters(const CheckpointHeader &header, FluidParameters &parameters)
+{
+    parameters.nx = header.nx;
+    parameters.ny = header.ny;
+    parameters.nz = header.nz;
+    parameters.dt = header.dt;
+    parameters.adaptiveTimeStep = header.adaptiveTimeStep != 0;
+    parameters.cfl = header.cfl;
+    parameters.forceFactor = header.forceFactor;
+    parameters.minDt = header.minDt;
+    parameters.simulatedVolume = header.simulatedVolume;
+    parameters.gravity = header.gravity;
+    parameters.restDensity = header.restDensity;
+    parameters.h = header.h;
+    parameters.stiffness = header.stiffness;
+    parameters.damping = header.damping;
+    parameters.m = header.m;
+    parameters.mu = header.mu;
+    parameters.gridType = (GridType)header.gridType;
+    parameters.tableSize = header.tableSize;
+    parameters.skin = header.skin;
+    parameters.pressureSolver = (PressureSolver)header.pressureSolver;
+    parameters.solverIterations = header.solverIterations;
+    parameters.densityTolerance = header.densityTolerance;
+    parameters.relaxation = header.relaxation;
+    parameters.sleepSteps = header.sleepSteps;
+    parameters.sleepSpeed = header.sleepSpeed;
+    parameters.sleepDensityChange = header.sleepDensityChange;
+}
+
+static bool validHeader(const CheckpointHeader &header, const string &path)
+{
+    if (memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) != 0)
+        cerr << path << " is not a checkpoint" << endl;
+    else if (header.byteOrder != byteOrderMark)
+        cerr << path << " was written on a machine with a different byte order" << endl;
+    else if (header.version > checkpointVersion)
+        cerr << path << " has version " << header.version << ", this build reads up to " << checkpointVersion << endl;
+    else if (header.headerSize < sizeof(CheckpointHeader) || header.headerSize > checkpointAlignment || header.headerSize + (uint64_t)header.sectionCount * sizeof(CheckpointSection) > checkpointAlignment || header.particleCount < 0)
+        cerr << path << " has a corrupt header" << endl;
+    else
+        return true;
+    return false;
+}
+
+// one piece of the file, written in order
+struct Chunk
+{
+    const void *data;
+    size_t size;
+};
+
+#ifdef _WIN32
+static bool writeChunks(const string &path, const vector<Chunk> &chunks)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = true;
+    for (const Chunk &chunk : chunks)
+        ok = ok && fwrite(chunk.data, 1, chunk.size, file) == chunk.size;
+    return fclose(file) == 0 && ok;
+}
+#else
+// one writev call per IOV_MAX chunks, resumed after partial writes
+static bool writeChunks(const string &path, const vector<Chunk> &chunks)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    vector<iovec> vectors(chunks.size());
+    for (size_t i = 0; i < chunks.size(); i++)
+        vectors[i] = {(void *)chunks[i].data, chunks[i].size};
+    size_t next = 0;
+    bool ok = true;
+    while (ok && next < vectors.size())
+    {
+        int count = (int)min<size_t>(vectors.size() - next, IOV_MAX);
+        ssize_t written = writev(fd, &vectors[next], count);
+        if (written < 0)
+        {
+            ok = errno == EINTR;
+            continue;
+        }
+        while (next < vectors.size() && (size_t)written >= vectors[next].iov_len)
+            written -= vectors[next++].iov_len;
+        if (written > 0)
+        {
+            vectors[next].iov_base = (char *)vectors[next].iov_base + written;
+            vectors[next].iov_len -= written;
+        }
+    }
+    // a restart must not find a file that is only partly on disk
+    ok = ok && fsync(fd) == 0;
+    return close(fd) == 0 && ok;
+}
+#endif
+
+bool Checkpoint::save(const Fluid &fluid, const string &path)
+{
+    const Particles &particles = fluid.particles;
+    const NeighborList &neighbors = fluid.neighbors;
+    int n = particles.size();
+    int padded = particles.paddedSize();
+
+    // name and values of every section, all of them n 4 byte values followed by zeros
+    vector<pair<const char *, const void *>> arrays;
+    for (int i = 0; i < particleArrayCount; i++)
+        arrays.push_back({particleArrays[i].name, (particles.*particleArrays[i].array).data()});
+    arrays.push_back({idArray, particles.id.data()});
+    bool references = neighbors.builds > 0 && (int)neighbors.x0.size() == n;
+    if (references)
+    {
+        arrays.push_back({referenceArrays[0], neighbors.x0.data()});
+        arrays.push_back({referenceArrays[1], neighbors.y0.data()});
+        arrays.push_back({referenceArrays[2], neighbors.z0.data()});
+    }
+    vector<int> quiet;
+    if (references && fluid.activity.enabled() && fluid.activity.bucketCount() == fluid.grid->bucketCount())
+    {
+        quiet.resize(n);
+        for (int i = 0; i < n; i++)
+            quiet[i] = fluid.activity.quiet(fluid.grid->bucketOf(i));
+        arrays.push_back({quietArray, quiet.data()});
+    }
+
+    vector<char> headerBlock(checkpointAlignment, 0);
+    CheckpointHeader header = {};
+    memcpy(header.magic, checkpointMagic, sizeof(checkpointMagic));
+    header.version = checkpointVersion;
+    header.byteOrder = byteOrderMark;
+    header.headerSize = sizeof(CheckpointHeader);
+    header.sectionCount = (uint32_t)arrays.size();
+    header.particleCount = n;
+    header.paddedCount = padded;
+    header.time = fluid.time;
+    header.lastDt = fluid.lastDt;
+    header.maxSpeed = fluid.maxSpeed;
+    header.maxAcceleration = fluid.maxAcceleration;
+    header.stepCount = fluid.stepCount;
+    storeParameters(header, fluid.parameters);
+    memcpy(headerBlock.data(), &header, sizeof(header));
+
+    // the arrays are written straight from where they are, only the header is copied
+    static const char zeros[checkpointAlignment] = {};
+    vector<Chunk> chunks = {{headerBlock.data(), headerBlock.size()}};
+    CheckpointSection *sections = (CheckpointSection *)(headerBlock.data() + sizeof(CheckpointHeader));
+    uint64_t offset = checkpointAlignment;
+    for (size_t i = 0; i < arrays.size(); i++)
+    {
+        CheckpointSection &section = sections[i];
+        strncpy(section.name, arrays[i].first, sizeof(section.name) - 1);
+        section.elementSize = sizeof(float);
+        section.count = n;
+        section.offset = offset;
+        section.size = (uint64_t)padded * sizeof(float);
+        uint64_t written = (uint64_t)n * sizeof(float);
+        chunks.push_back({arrays[i].second, (size_t)written});
+        // the zeros cover the array padding too, particleAlignment divides checkpointAlignment
+        for (uint64_t padding = alignUp(section.size) - written; padding > 0; padding -= min(padding, checkpointAlignment))
+            chunks.push_back({zeros, (size_t)min(padding, checkpointAlignment)});
+        offset += alignUp(section.size);
+    }
+
+    // replace the old checkpoint only once the new one is complete
+    string temporary = path + ".tmp";
+    if (!writeChunks(temporary, chunks))
+    {
+        cerr << "Can't write " << temporary << endl;
+        remove(temporary.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    remove(path.c_str());
+#endif
+    if (rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        cerr << "Can't replace " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+bool Checkpoint::readParameters(const string &path, FluidParameters &parameters)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        cerr << "Can't open " << path << endl;
+        return false;
+    }
+    CheckpointHeader header;
+    bool read = fread(&header, sizeof(header), 1, file) == 1;
+    fclose(file);
+    if (!read)
+    {
+        cerr << path << " is not a checkpoint" << endl;
+        return false;
+    }
+    if (!validHeader(header, path))
+        return false;
+    loadParameters(header, parameters);
+    return true;
+}
+
+unique_ptr<Fluid> Checkpoint::load(const string &path)
+{
+    FluidParameters parameters;
+    if (!readParameters(path, parameters))
+        return nullptr;
+    return load(path, parameters);
+}
+
+unique_ptr<Fluid> Checkpoint::load(const string &path, const FluidParameters &parameters)
+{
+    // the whole file as one block that the particle arrays point into
+    const char *base;
+    uint64_t fileSize;
+    shared_ptr<void> storage;
+#ifdef _WIN32
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        cerr << "Can't open " << path << endl;
+        return nullptr;
+    }
+    _fseeki64(file, 0, SEEK_END);
+    fileSize = _ftelli64(file);
+    _fseeki64(file, 0, SEEK_SET);
+    if (fileSize < checkpointAlignment)
+    {
+        cerr << path << " is not a checkpoint" << endl;
+        fclose(file);
+        return nullptr;
+    }
+    char *buffer = static_cast<char *>(::operator new[](fileSize + 1, align_val_t(checkpointAlignment)));
+    storage = shared_ptr<void>(buffer, [](void *p)
+                               { ::operator delete[](p, align_val_t(checkpointAlignment)); });
+    bool read = fread(buffer, 1, fileSize, file) == fileSize;
+    fclose(file);
+    if (!read)
+    {
+        cerr << "Can't read " << path << endl;
+        return nullptr;
+    }
+    base = buffer;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        cerr << "Can't open " << path << endl;
+        return nullptr;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+    {
+        cerr << "Can't read " << path << endl;
+        close(fd);
+        return nullptr;
+    }
+    fileSize = status.st_size;
+    if (fileSize < checkpointAlignment)
+    {
+        cerr << path << " is not a checkpoint" << endl;
+        close(fd);
+        return nullptr;
+    }
+    // private and writable: pages are read from the file when first touched and copied when first written,
+    // the solver never changes the checkpoint
+    void *mapped = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        cerr << "Can't map " << path << endl;
+        return nullptr;
+    }
+    storage = shared_ptr<void>(mapped, [fileSize](void *p)
+                               { munmap(p, fileSize); });
+    base = (const char *)mapped;
+#endif
+
+    CheckpointHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (!validHeader(header, path))
+        return nullptr;
+    const CheckpointSection *sections = (const CheckpointSection *)(base + header.headerSize);
+
+    // construct without particles, they come from the file
+    FluidParameters empty = parameters;
+    empty.nx = empty.ny = empty.nz = 0;
+    unique_ptr<Fluid> fluid = make_unique<Fluid>(empty);
+    fluid->parameters = parameters;
+    fluid->parameters.nx = header.nx;
+    fluid->parameters.ny = header.ny;
+    fluid->parameters.nz = header.nz;
+    if (fluid->pressureSolver == PressureSolver::Implicit)
+        fluid->restDensity = fluid->initialDensity();
+    fluid->time = header.time;
+    fluid->lastDt = header.lastDt;
+    fluid->maxSpeed = header.maxSpeed;
+    fluid->maxAcceleration = header.maxAcceleration;
+    fluid->stepCount = header.stepCount;
+
+    int n = header.particleCount;
+    int padded = (n + particlePadding - 1) / particlePadding * particlePadding;
+    auto findSection = [&](const char *name) -> const CheckpointSection *
+    {
+        for (uint32_t k = 0; k < header.sectionCount; k++)
+        {
+            if (strncmp(sections[k].name, name, sizeof(sections[k].name)) == 0)
+                return &sections[k];
+        }
+        return nullptr;
+    };
+    // point array at a section, or copy it if this build pads arrays differently. false if the section is broken
+    auto bind = [&](auto &array, const CheckpointSection &section)
+    {
+        using T = remove_reference_t<decltype(array[0])>;
+        if (section.elementSize != sizeof(T) || section.count != n || section.size < (uint64_t)n * sizeof(T) || section.offset + section.size > fileSize)
+        {
+            cerr << path << " has a corrupt section " << string(section.name, strnlen(section.name, sizeof(section.name))) << endl;
+            return false;
+        }
+        const char *values = base + section.offset;
+        if (section.size >= (uint64_t)padded * sizeof(T) && (uintptr_t)values % particleAlignment == 0)
+            array.adopt((T *)values, n, padded, storage);
+        else
+        {
+            array.resize(n);
+            memcpy(array.data(), values, (size_t)n * sizeof(T));
+        }
+        return true;
+    };
+
+    Particles &particles = fluid->particles;
+    const CheckpointSection *positions[3] = {findSection("x"), findSection("y"), findSection("z")};
+    const CheckpointSection *references[3];
+    for (int i = 0; i < 3; i++)
+        references[i] = findSection(referenceArrays[i]);
+    if (references[0] && references[1] && references[2] && positions[0] && positions[1] && positions[2])
+    {
+        // build the neighbor list at the reference positions, then move on to the actual ones
+        if (!bind(particles.x, *references[0]) || !bind(particles.y, *references[1]) || !bind(particles.z, *references[2]))
+            return nullptr;
+        // the particles are still in the order of that build, so they are not reordered again
+        fluid->rebuildNeighbors(false);
+    }
+    for (int i = 0; i < particleArrayCount; i++)
+    {
+        AlignedArray<float> &array = particles.*particleArrays[i].array;
+        const CheckpointSection *section = findSection(particleArrays[i].name);
+        if (!section && particleArrays[i].required)
+        {
+            cerr << path << " has no section " << particleArrays[i].name << endl;
+            return nullptr;
+        }
+        // written by a version without this array
+        if (!section)
+            array.resize(n);
+        else if (!bind(array, *section))
+            return nullptr;
+    }
+    const CheckpointSection *ids = findSection(idArray);
+    if (!ids)
+    {
+        particles.id.resize(n);
+        for (int i = 0; i < n; i++)
+            particles.id[i] = i;
+    }
+    else if (!bind(particles.id, *ids))
+        return nullptr;
+    fluid->maxDisplacementSquared = fluid->neighbors.maxDisplacementSquared(particles, fluid->pool);
+    // the grid holds the cells of the reference build, the ones the quiet steps belong to
+    const CheckpointSection *quietSection = findSection(quietArray);
+    if (quietSection && fluid->neighbors.builds > 0 && fluid->activity.enabled())
+    {
+        AlignedArray<int> quiet;
+        if (!bind(quiet, *quietSection))
+            return nullptr;
+        fluid->activity.resize(fluid->grid->bucketCount());
+        for (int i = 0; i < n; i++)
+            fluid->activity.setQuiet(fluid->grid->bucketOf(i), quiet[i]);
+        fluid->activity.count(*fluid->grid);
+    }
+    return fluid;
+}
\ No newline at end of file
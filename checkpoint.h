@@ -0,0 +1,93 @@
+#pragma once
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+#include "fluid.h"
+
+/*
+Binary checkpoint of the full solver state.
+
+Layout: a CheckpointHeader and the section table in the first checkpointAlignment bytes,
+then one section per particle array, each starting on a checkpointAlignment boundary and
+holding the padded array. Everything else (grid, neighbor list, pair cache) is rebuilt on
+the first step. Sections are looked up by name, so arrays can be added without breaking old files.
+Numbers are stored in the byte order of the writing machine, checked through byteOrder.
+*/
+constexpr char checkpointMagic[8] = {'S', 'P', 'H', 'C', 'K', 'P', 'T', 0};
+constexpr uint32_t checkpointVersion = 1;
+// a page, so sections can be mapped in place and written with O_DIRECT
+constexpr uint64_t checkpointAlignment = 4096;
+
+struct CheckpointSection
+{
+    char name[16];
+    uint32_t elementSize;
+    int32_t count;
+    uint64_t offset;
+    // bytes, padded elements included
+    uint64_t size;
+};
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t headerSize;
+    uint32_t sectionCount;
+    int32_t particleCount;
+    int32_t paddedCount;
+    double time;
+    // steps taken, which the diagnostics interval and anything else counting steps go by
+    int64_t stepCount;
+    float lastDt;
+    float maxSpeed;
+    float maxAcceleration;
+    // FluidParameters, except threads which belong to the machine
+    int32_t nx, ny, nz;
+    float dt;
+    int32_t adaptiveTimeStep;
+    float cfl;
+    float forceFactor;
+    float minDt;
+    float simulatedVolume;
+    float gravity;
+    float restDensity;
+    float h;
+    float stiffness;
+    float damping;
+    float m;
+    float mu;
+    int32_t gridType;
+    int32_t tableSize;
+    float skin;
+    int32_t pressureSolver;
+    int32_t solverIterations;
+    float densityTolerance;
+    float relaxation;
+    int32_t sleepSteps;
+    float sleepSpeed;
+    float sleepDensityChange;
+};
+
+class Checkpoint
+{
+public:
+    /*
+    Write the state of fluid to path in a single gathered write. Prints the reason and returns false on failure.
+    */
+    static bool save(const Fluid &fluid, const std::string &path);
+    /*
+    Read the parameters stored in a checkpoint, to be modified before load, e.g. to fork a parameter study.
+    threads is left as it is.
+    */
+    static bool readParameters(const std::string &path, FluidParameters &parameters);
+    /*
+    Restore a fluid from a checkpoint. The particle arrays are mapped copy-on-write straight from the file,
+    nothing is read before it is touched. The particles, time, step count and time step state come from the file,
+    everything else from parameters. Returns nullptr on failure.
+    */
+    static std::unique_ptr<Fluid> load(const std::string &path, const FluidParameters &parameters);
+    static std::unique_ptr<Fluid> load(const std::string &path);
+};
\ No newline at end of file
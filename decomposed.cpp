@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#include "domain.h"
+#include "sharedMemoryTransport.h"
+
+using namespace std;
+
+/*
+Runs the fluid decomposed into slabs, one process per slab, over the shared memory transport.
+Without --rank the processes are forked here, with --rank and --name every rank is started
+on its own, e.g. to pin them to cores. Rank 0 prints the report.
+*/
+
+struct RankReport
+{
+    int owned;
+    int ghosts;
+    float begin;
+    float end;
+    long long migrations;
+    int neighborListBuilds;
+    double seconds;
+};
+
+static void printUsage(const char *program)
+{
+    cout << "usage: " << program << " [options]\n"
+         << "  --ranks N         processes, one slab each (default 2)\n"
+         << "  --rank R          start only rank R of a run another process created, needs --name\n"
+         << "  --name NAME       shared memory name (default /sph-<pid of rank 0>)\n"
+         << "  --particles N     total particle count, rounded to a cube (default 1000)\n"
+         << "  --block X Y Z     particle block dimensions instead of --particles\n"
+         << "  --steps N         number of timed steps (default 1000)\n"
+         << "  --warmup N        untimed steps before measuring (default 10)\n"
+         << "  --dt F            time step, upper bound with --adaptive\n"
+         << "  --adaptive        adaptive CFL time step, the smallest of all ranks\n"
+         << "  --h F             smoothing length\n"
+         << "  --gravity F\n"
+         << "  --stiffness F\n"
+         << "  --mu F            viscosity\n"
+         << "  --grid hash|dense grid backend (default dense)\n"
+         << "  --threads N       worker threads per rank (default: hardware threads / ranks)\n"
+         << "  --rebalance N     check the balance every N steps, 0 never (default 50)\n"
+         << "  --imbalance F     move the borders once a slab holds 1 + F times the mean (default 0.1)\n"
+         << "  --ring-bytes N    shared memory ring size per pair of ranks (default 1048576)\n"
+         << "  --diagnostics N   print energies, max speed, density error and momentum every N steps\n"
+         << "--particles rounds to a cube and scales h, skin and mass with the spacing, later options override them.\n";
+}
+
+static int run(const string &name, int rank, int ranks, size_t ringBytes, const FluidParameters &parameters,
+               int steps, int warmup, int rebalanceInterval, float imbalance)
+{
+    SharedMemoryTransport transport(name, rank, ranks, ringBytes);
+    if (!transport.isOpen())
+        return 1;
+    unique_ptr<Domain> domain = Domain::create(transport, parameters, rebalanceInterval, imbalance);
+    if (!domain)
+        return 1;
+    bool report = rank == 0;
+    if (report)
+    {
+        cout << "ranks: " << ranks << endl;
+        cout << "threads per rank: " << domain->getFluid().threadCount() << endl;
+        cout << "kernel: " << Kernel::isaName() << endl;
+        cout << "halo width: " << domain->getHaloWidth() << endl;
+        cout << "steps: " << steps << " (+" << warmup << " warmup)" << endl;
+    }
+
+    for (int i = 0; i < warmup; i++)
+    {
+        if (!domain->step())
+            return 1;
+    }
+    if (!transport.barrier())
+        return 1;
+    int builds = domain->getFluid().neighborListBuilds();
+    long long migrations = domain->migrations();
+    auto start = chrono::steady_clock::now();
+    long long printed = -1;
+    for (int i = 0; i < steps; i++)
+    {
+        if (!domain->step())
+            return 1;
+        Diagnostics sample;
+        if (report && domain->getDiagnostics(sample) && sample.step != printed)
+        {
+            printed = sample.step;
+            cout << "step " << sample.step << " t " << sample.time << " particles " << sample.particles
+                 << " energy " << sample.totalEnergy() << " (kinetic " << sample.kineticEnergy << ", potential " << sample.potentialEnergy << ")"
+                 << " max speed " << sample.maxSpeed
+                 << " density error " << sample.meanDensityError << " mean " << sample.maxDensityError << " max"
+                 << " momentum " << sample.momentum.x << " " << sample.momentum.y << " " << sample.momentum.z << endl;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    const vector<float> &borders = domain->getBorders();
+    RankReport mine = {domain->ownedCount(), domain->ghosts(), borders[rank], borders[rank + 1],
+                       domain->migrations() - migrations, domain->getFluid().neighborListBuilds() - builds, seconds};
+    vector<char> message(sizeof(mine));
+    memcpy(message.data(), &mine, sizeof(mine));
+    vector<vector<char>> messages;
+    if (!transport.allGather(message, messages))
+        return 1;
+    if (!report)
+        return 0;
+
+    vector<RankReport> reports(ranks);
+    long long particles = 0;
+    double slowest = 0;
+    for (int r = 0; r < ranks; r++)
+    {
+        memcpy(&reports[r], messages[r].data(), sizeof(RankReport));
+        particles += reports[r].owned;
+        slowest = max(slowest, reports[r].seconds);
+    }
+    cout << "particles: " << particles << endl;
+    cout << "time: " << slowest << " s" << endl;
+    cout << "steps/s: " << steps / slowest << endl;
+    cout << "ns/particle-step: " << slowest * 1e9 / ((double)steps * particles) << endl;
+    cout << "rebalances: " << domain->rebalances() << endl;
+    cout << setw(6) << "rank" << setw(10) << "owned" << setw(10) << "ghosts" << setw(22) << "slab" << setw(12) << "migrated" << setw(10) << "builds" << endl;
+    for (int r = 0; r < ranks; r++)
+    {
+        const RankReport &rank = reports[r];
+        cout << setw(6) << r << setw(10) << rank.owned << setw(10) << rank.ghosts
+             << "  [" << fixed << setprecision(4) << setw(8) << rank.begin << ", " << setw(7) << rank.end << ")" << defaultfloat
+             << setw(12) << rank.migrations << setw(10) << rank.neighborListBuilds << endl;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    FluidParameters parameters;
+    int ranks = 2;
+    int rank = -1;
+    string name;
+    int steps = 1000;
+    int warmup = 10;
+    int rebalanceInterval = 50;
+    float imbalance = 0.1f;
+    size_t ringBytes = 1 << 20;
+    parameters.threads = -1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        auto value = [&](int offset = 1) -> const char *
+        {
+            if (i + offset >= argc)
+            {
+                cerr << "missing value for " << arg << endl;
+                exit(1);
+            }
+            return argv[i + offset];
+        };
+        if (arg == "--ranks")
+            ranks = atoi(value()), i++;
+        else if (arg == "--rank")
+            rank = atoi(value()), i++;
+        else if (arg == "--name")
+            name = value(), i++;
+        else if (arg == "--particles")
+            parameters.setParticleCount((int)atof(value())), i++;
+        else if (arg == "--block")
+        {
+            parameters.nx = atoi(value(1));
+            parameters.ny = atoi(value(2));
+            parameters.nz = atoi(value(3));
+            i += 3;
+        }
+        else if (arg == "--steps")
+            steps = atoi(value()), i++;
+        else if (arg == "--warmup")
+            warmup = atoi(value()), i++;
+        else if (arg == "--dt")
+            parameters.dt = (float)atof(value()), i++;
+        else if (arg == "--adaptive")
+            parameters.adaptiveTimeStep = true;
+        else if (arg == "--h")
+            parameters.h = (float)atof(value()), i++;
+        else if (arg == "--gravity")
+            parameters.gravity = (float)atof(value()), i++;
+        else if (arg == "--stiffness")
+            parameters.stiffness = (float)atof(value()), i++;
+        else if (arg == "--mu")
+            parameters.mu = (float)atof(value()), i++;
+        else if (arg == "--grid")
+        {
+            string type = value();
+            if (type == "hash")
+                parameters.gridType = GridType::Hash;
+            else if (type == "dense")
+                parameters.gridType = GridType::Dense;
+            else
+            {
+                cerr << "unknown grid " << type << endl;
+                return 1;
+            }
+            i++;
+        }
+        else if (arg == "--threads")
+            parameters.threads = atoi(value()), i++;
+        else if (arg == "--rebalance")
+            rebalanceInterval = atoi(value()), i++;
+        else if (arg == "--imbalance")
+            imbalance = (float)atof(value()), i++;
+        else if (arg == "--ring-bytes")
+            ringBytes = (size_t)atof(value()), i++;
+        else if (arg == "--diagnostics")
+            parameters.diagnosticsInterval = atoi(value()), i++;
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            cerr << "unknown option " << arg << endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (ranks < 1 || rank >= ranks)
+    {
+        cerr << "need 0 <= rank < ranks" << endl;
+        return 1;
+    }
+    if (rank >= 0 && name.empty())
+    {
+        cerr << "--rank needs the --name rank 0 was started with" << endl;
+        return 1;
+    }
+    if (parameters.threads < 0)
+        parameters.threads = max((int)thread::hardware_concurrency() / ranks, 1);
+
+#ifndef _WIN32
+    if (rank >= 0)
+        return run(name, rank, ranks, ringBytes, parameters, steps, warmup, rebalanceInterval, imbalance);
+    if (name.empty())
+        name = "/sph-" + to_string(getpid());
+    // the workers are forked before any thread exists
+    vector<pid_t> children;
+    rank = 0;
+    for (int r = 1; r < ranks; r++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+            return run(name, r, ranks, ringBytes, parameters, steps, warmup, rebalanceInterval, imbalance);
+        if (pid == -1)
+        {
+            perror("fork");
+            return 1;
+        }
+        children.push_back(pid);
+    }
+    int result = run(name, rank, ranks, ringBytes, parameters, steps, warmup, rebalanceInterval, imbalance);
+    for (pid_t child : children)
+    {
+        int status = 0;
+        if (waitpid(child, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            result = 1;
+    }
+    return result;
+#else
+    cerr << "decomposed runs need POSIX processes and shared memory" << endl;
+    return 1;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "diagnostics.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace glm;
+using namespace std;
+
+DiagnosticsCollector::DiagnosticsCollector(int interval) : interval(interval), requested(false), particles(0), sampled(false)
+{
+}
+
+bool DiagnosticsCollector::beginStep(long long step, int particleCount, int blockCount)
+{
+    bool sample = requested.exchange(false) || (interval > 0 && (step + 1) % interval == 0);
+    if (!sample)
+        return false;
+    particles = particleCount;
+    blocks.resize(blockCount);
+    return true;
+}
+
+void DiagnosticsCollector::endStep(long long step, double time, float m, float gravity, int sleepingParticles)
+{
+    DiagnosticsSums total = {};
+    for (const DiagnosticsSums &block : blocks)
+    {
+        total.speedSquared += block.speedSquared;
+        total.height += block.height;
+        total.densityError += block.densityError;
+        total.momentumX += block.momentumX;
+        total.momentumY += block.momentumY;
+        total.momentumZ += block.momentumZ;
+        total.maxSpeedSquared = std::max(total.maxSpeedSquared, block.maxSpeedSquared);
+        total.maxDensityError = std::max(total.maxDensityError, block.maxDensityError);
+    }
+    Diagnostics diagnostics;
+    diagnostics.step = step;
+    diagnostics.time = time;
+    diagnostics.particles = particles;
+    diagnostics.kineticEnergy = 0.5 * m * total.speedSquared;
+    diagnostics.potentialEnergy = (double)m * gravity * total.height;
+    diagnostics.maxSpeed = std::sqrt(total.maxSpeedSquared);
+    diagnostics.meanDensityError = particles > 0 ? total.densityError / particles : 0;
+    diagnostics.maxDensityError = total.maxDensityError;
+    diagnostics.momentum = dvec3(total.momentumX, total.momentumY, total.momentumZ) * (double)m;
+    diagnostics.sleepingParticles = sleepingParticles;
+
+    lock_guard<std::mutex> lock(mutex);
+    newest = diagnostics;
+    sampled = true;
+}
+
+bool DiagnosticsCollector::latest(Diagnostics &diagnostics) const
+{
+    lock_guard<std::mutex> lock(mutex);
+    if (sampled)
+        diagnostics = newest;
+    return sampled;
+}
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/*
+Global quantities of one step, taken after the integration
+*/
+struct Diagnostics
+{
+    // steps since the fluid was created and the simulated time after the sampled step
+    long long step = 0;
+    double time = 0;
+    int particles = 0;
+    // sum of m v^2 / 2
+    double kineticEnergy = 0;
+    // sum of m g (y + 1), zero on the floor
+    double potentialEnergy = 0;
+    double totalEnergy() const { return kineticEnergy + potentialEnergy; }
+    float maxSpeed = 0;
+    // |rho - rho0| / rho0 of the densities the step used
+    double meanDensityError = 0;
+    float maxDensityError = 0;
+    glm::dvec3 momentum = glm::dvec3(0);
+    // particles in sleeping cells, at rest
+    int sleepingParticles = 0;
+};
+
+/*
+Partial sums over one block of particles
+*/
+struct DiagnosticsSums
+{
+    double speedSquared;
+    double height;
+    double densityError;
+    double momentumX;
+    double momentumY;
+    double momentumZ;
+    float maxSpeedSquared;
+    float maxDensityError;
+};
+
+/*
+Samples Diagnostics every interval steps or on request. The solver fills the sums of
+blocks of particles inside its own parallel passes, the blocks are then added up in order.
+Blocks are the solver's grid tasks, which don't depend on the thread count, and neither does the result.
+The latest sample can be read from any thread.
+*/
+class DiagnosticsCollector
+{
+public:
+    DiagnosticsCollector(int interval = 0);
+    // 0 only samples on request
+    void setInterval(int steps) { interval = steps; }
+    int getInterval() const { return interval; }
+    // sample the next step regardless of the interval
+    void request() { requested = true; }
+    /*
+    Called by the solver before its passes, true if this step is sampled.
+    The sums of every block must then be written with sumsOf.
+    */
+    bool beginStep(long long step, int particleCount, int blockCount);
+    DiagnosticsSums &sumsOf(int block) { return blocks[block]; }
+    // reduce the blocks of a sampled step and publish the result
+    void endStep(long long step, double time, float m, float gravity, int sleepingParticles);
+    // copy of the newest sample, false if nothing was sampled yet
+    bool latest(Diagnostics &diagnostics) const;
+
+private:
+    int interval;
+    std::atomic<bool> requested;
+    int particles;
+    std::vector<DiagnosticsSums> blocks;
+    mutable std::mutex mutex;
+    bool sampled;
+    Diagnostics newest;
+};
\ No newline at end of file
@@ -0,0 +1,357 @@
+#include "domain.h"
+
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+using namespace std;
+
+// resolution of the particle histogram the borders are placed on
+static const int histogramBins = 1024;
+
+template <typename T>
+static vector<char> pack(const vector<T> &values)
+{
+    vector<char> bytes(values.size() * sizeof(T));
+    if (!values.empty())
+        memcpy(bytes.data(), values.data(), bytes.size());
+    return bytes;
+}
+
+// appends the values of bytes
+template <typename T>
+static void unpack(const vector<char> &bytes, vector<T> &values)
+{
+    size_t count = bytes.size() / sizeof(T);
+    size_t first = values.size();
+    values.resize(first + count);
+    if (count > 0)
+        memcpy(&values[first], bytes.data(), count * sizeof(T));
+}
+
+static int binOf(float x)
+{
+    return std::clamp((int)((x + 1) * 0.5f * histogramBins), 0, histogramBins - 1);
+}
+
+static ParticleRecord recordOf(const Particles &particles, int i)
+{
+    ParticleRecord record;
+    record.id = particles.id[i];
+    record.x = particles.x[i];
+    record.y = particles.y[i];
+    record.z = particles.z[i];
+    record.vx = particles.vx[i];
+    record.vy = particles.vy[i];
+    record.vz = particles.vz[i];
+    return record;
+}
+
+unique_ptr<Domain> Domain::create(Transport &transport, const FluidParameters &parameters, int rebalanceInterval, float rebalanceTolerance)
+{
+    if (parameters.pressureSolver != PressureSolver::EquationOfState)
+    {
+        cerr << "domain decomposition needs the equation of state solver" << endl;
+        return nullptr;
+    }
+    if (parameters.sleepSteps > 0)
+    {
+        cerr << "domain decomposition doesn't support sleeping cells" << endl;
+        return nullptr;
+    }
+    // two support radii of 4h, see Domain
+    float haloWidth = 8 * parameters.h;
+    if (transport.size() * haloWidth > 2)
+    {
+        cerr << transport.size() << " slabs of at least " << haloWidth << " don't fit in the box, use fewer ranks or a smaller h" << endl;
+        return nullptr;
+    }
+    return unique_ptr<Domain>(new Domain(transport, parameters, rebalanceInterval, rebalanceTolerance));
+}
+
+Domain::Domain(Transport &transport, const FluidParameters &parameters, int rebalanceInterval, float rebalanceTolerance) : transport(transport)
+{
+    this->haloWidth = 8 * parameters.h;
+    this->rebalanceInterval = rebalanceInterval;
+    this->rebalanceTolerance = rebalanceTolerance;
+    this->ghostCount = 0;
+    this->migrated = 0;
+    this->rebalanceCount = 0;
+    this->sampled = false;
+
+    // every rank places the same borders from the layers of the initial block without talking, then creates its slab
+    int nx = parameters.nx;
+    int layer = parameters.ny * parameters.nz;
+    vector<long long> histogram(histogramBins, 0);
+    for (int x = 0; x < nx; x++)
+        histogram[binOf((float)x / nx - 0.5f)] += layer;
+    placeBorders(histogram);
+    float begin, end;
+    ownedRange(begin, end);
+    this->fluid = make_unique<Fluid>(parameters, begin, end);
+    fluid->setOwnedRange(begin, end, haloWidth);
+}
+
+int Domain::ownerOf(float x) const
+{
+    return (int)(upper_bound(borders.begin() + 1, borders.end() - 1, x) - (borders.begin() + 1));
+}
+
+void Domain::placeBorders(const vector<long long> &histogram)
+{
+    int size = transport.size();
+    long long total = 0;
+    for (long long count : histogram)
+        total += count;
+    float binWidth = 2.0f / histogramBins;
+    borders.assign(size + 1, 0);
+    borders[0] = -1;
+    borders[size] = 1;
+    long long below = 0;
+    int bin = 0;
+    for (int k = 1; k < size; k++)
+    {
+        double target = (double)total * k / size;
+        while (bin < histogramBins && below + histogram[bin] < target)
+            below += histogram[bin++];
+        // particles are taken as spread evenly within a bin
+        double fraction = bin < histogramBins && histogram[bin] > 0 ? (target - below) / histogram[bin] : 0;
+        borders[k] = -1 + (float)(bin + fraction) * binWidth;
+    }
+    // create made sure slabs of haloWidth fit
+    for (int k = 1; k < size; k++)
+        borders[k] = std::max(borders[k], borders[k - 1] + haloWidth);
+    for (int k = size - 1; k > 0; k--)
+        borders[k] = std::min(borders[k], borders[k + 1] - haloWidth);
+}
+
+void Domain::ownedRange(float &begin, float &end) const
+{
+    // the outer slabs own everything up to and beyond the walls
+    int rank = transport.rank();
+    float infinity = numeric_limits<float>::infinity();
+    begin = rank > 0 ? borders[rank] : -infinity;
+    end = rank < transport.size() - 1 ? borders[rank + 1] : infinity;
+}
+
+bool Domain::step()
+{
+    long long steps = fluid->getStepCount();
+    if (rebalanceInterval > 0 && steps > 0 && steps % rebalanceInterval == 0 && !rebalance())
+        return false;
+    if (!migrate() || !exchangeGhosts())
+        return false;
+
+    // the smallest step any rank asks for
+    float dt = fluid->computeTimeStep();
+    if (fluid->getParameters().adaptiveTimeStep)
+    {
+        vector<vector<char>> requests;
+        if (!transport.allGather(pack(vector<float>{dt}), requests))
+            return false;
+        for (const vector<char> &message : requests)
+        {
+            vector<float> other;
+            unpack(message, other);
+            dt = std::min(dt, other[0]);
+        }
+    }
+    fluid->step(dt);
+
+    int interval = fluid->getParameters().diagnosticsInterval;
+    if (interval > 0 && fluid->getStepCount() % interval == 0)
+        return gatherDiagnostics();
+    return true;
+}
+
+bool Domain::rebalance()
+{
+    // the owned particles over x and per slab, emigrants still count where they are now
+    int size = transport.size();
+    const Particles &particles = fluid->getParticles();
+    vector<long long> counts(histogramBins + size, 0);
+    for (int i = 0; i < particles.size(); i++)
+    {
+        if (fluid->isGhost(i))
+            continue;
+        float x = particles.x[i];
+        counts[binOf(x)]++;
+        counts[histogramBins + ownerOf(x)]++;
+    }
+    vector<vector<char>> messages;
+    if (!transport.allGather(pack(counts), messages))
+        return false;
+    vector<long long> total(counts.size(), 0);
+    for (const vector<char> &message : messages)
+    {
+        vector<long long> other;
+        unpack(message, other);
+        for (size_t k = 0; k < total.size(); k++)
+            total[k] += other[k];
+    }
+
+    long long sum = 0;
+    long long largest = 0;
+    for (int r = 0; r < size; r++)
+    {
+        sum += total[histogramBins + r];
+        largest = std::max(largest, total[histogramBins + r]);
+    }
+    if (largest <= (1 + rebalanceTolerance) * sum / size)
+        return true;
+    total.resize(histogramBins);
+    vector<float> previous = borders;
+    placeBorders(total);
+    // a block of whole particle layers may not split any better
+    if (borders != previous)
+    {
+        float begin, end;
+        ownedRange(begin, end);
+        fluid->setOwnedRange(begin, end, haloWidth);
+        rebalanceCount++;
+    }
+    return true;
+}
+
+bool Domain::migrate()
+{
+    // send the particles that left the slab to their owner
+    int size = transport.size();
+    int rank = transport.rank();
+    const Particles &particles = fluid->getParticles();
+    int n = particles.size();
+    vector<unsigned char> remove(n, 0);
+    vector<vector<ParticleRecord>> leaving(size);
+    bool left = false;
+    for (int i = 0; i < n; i++)
+    {
+        if (fluid->isGhost(i))
+            continue;
+        int owner = ownerOf(particles.x[i]);
+        if (owner != rank)
+        {
+            leaving[owner].push_back(recordOf(particles, i));
+            remove[i] = 1;
+            left = true;
+        }
+    }
+
+    // rebalancing may move a particle past several borders, so every rank talks to every other
+    vector<int> others;
+    vector<vector<char>> outgoing;
+    for (int r = 0; r < size; r++)
+    {
+        if (r == rank)
+            continue;
+        others.push_back(r);
+        outgoing.push_back(pack(leaving[r]));
+    }
+    vector<vector<char>> incoming;
+    if (!transport.exchange(others, outgoing, others, incoming))
+        return false;
+    vector<ParticleRecord> arriving;
+    for (const vector<char> &message : incoming)
+        unpack(message, arriving);
+    if (!left && arriving.empty())
+        return true;
+
+    // the owned particles changed, the ghosts are dropped with the emigrants and sent again
+    for (int i = 0; i < n; i++)
+    {
+        if (fluid->isGhost(i))
+            remove[i] = 1;
+    }
+    fluid->removeParticles(remove);
+    ghostCount = 0;
+    if (!arriving.empty())
+        fluid->addParticles(arriving);
+    migrated += arriving.size();
+    return true;
+}
+
+bool Domain::exchangeGhosts()
+{
+    // slabs are at least haloWidth wide, so only the direct neighbors need a particle
+    int size = transport.size();
+    int rank = transport.rank();
+    const Particles &particles = fluid->getParticles();
+    vector<int> neighbors;
+    if (rank > 0)
+        neighbors.push_back(rank - 1);
+    if (rank < size - 1)
+        neighbors.push_back(rank + 1);
+    vector<vector<ParticleRecord>> halos(neighbors.size());
+    float left = borders[rank] + haloWidth;
+    float right = borders[rank + 1] - haloWidth;
+    for (int i = 0; i < particles.size(); i++)
+    {
+        if (fluid->isGhost(i))
+            continue;
+        float x = particles.x[i];
+        if (rank > 0 && x < left)
+            halos.front().push_back(recordOf(particles, i));
+        if (rank < size - 1 && x >= right)
+            halos.back().push_back(recordOf(particles, i));
+    }
+    vector<vector<char>> outgoing;
+    for (const vector<ParticleRecord> &halo : halos)
+        outgoing.push_back(pack(halo));
+    vector<vector<char>> incoming;
+    if (!transport.exchange(neighbors, outgoing, neighbors, incoming))
+        return false;
+    vector<ParticleRecord> ghosts;
+    for (const vector<char> &message : incoming)
+        unpack(message, ghosts);
+
+    // the same ghosts as last step only move, which keeps the neighbor list
+    if (ghostCount > 0 && fluid->updateGhosts(ghosts))
+        return true;
+    if (ghostCount > 0)
+    {
+        vector<unsigned char> remove(particles.size());
+        for (int i = 0; i < particles.size(); i++)
+            remove[i] = fluid->isGhost(i);
+        fluid->removeParticles(remove);
+    }
+    if (!ghosts.empty())
+        fluid->addParticles(ghosts);
+    ghostCount = (int)ghosts.size();
+    return true;
+}
+
+bool Domain::gatherDiagnostics()
+{
+    Diagnostics sample;
+    fluid->getDiagnostics(sample);
+    vector<vector<char>> messages;
+    if (!transport.allGather(pack(vector<Diagnostics>{sample}), messages))
+        return false;
+    combined = Diagnostics();
+    combined.step = sample.step;
+    combined.time = sample.time;
+    double densityError = 0;
+    for (const vector<char> &message : messages)
+    {
+        vector<Diagnostics> other;
+        unpack(message, other);
+        const Diagnostics &part = other[0];
+        combined.particles += part.particles;
+        combined.kineticEnergy += part.kineticEnergy;
+        combined.potentialEnergy += part.potentialEnergy;
+        combined.maxSpeed = std::max(combined.maxSpeed, part.maxSpeed);
+        densityError += part.meanDensityError * part.particles;
+        combined.maxDensityError = std::max(combined.maxDensityError, part.maxDensityError);
+        combined.momentum += part.momentum;
+    }
+    combined.meanDensityError = combined.particles > 0 ? densityError / combined.particles : 0;
+    sampled = true;
+    return true;
+}
+
+bool Domain::getDiagnostics(Diagnostics &sample) const
+{
+    if (sampled)
+        sample = combined;
+    return sampled;
+}
\ No newline at end of file
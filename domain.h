@@ -0,0 +1,72 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "diagnostics.h"
+#include "fluid.h"
+#include "transport.h"
+
+/*
+Slab decomposition of the [-1, 1]^3 box along x, one Fluid per process.
+Rank r owns the particles with borders[r] <= x < borders[r + 1], the outer slabs reach to the walls.
+Before every step particles that crossed a border migrate to their new owner, then every rank
+receives ghost copies of the particles within haloWidth of its borders. While no particle migrates
+and the same particles stay within haloWidth, the ghosts are moved in place and the neighbor lists kept. Two support radii of ghosts
+give the ghosts next to the border complete neighborhoods, so one exchange per step is enough
+for the equation of state, whose pressure only depends on the density.
+Every rebalanceInterval steps the ranks share a histogram of their particles and, if the largest slab
+holds more than 1 + rebalanceTolerance times the mean, move the borders to its quantiles.
+*/
+class Domain
+{
+public:
+    /*
+    Every rank creates only its own slab of the initial block. Returns nullptr with the reason on cerr
+    for the implicit solver, whose Jacobi iterations would need an exchange each, for sleeping cells,
+    or if the box is too narrow for slabs of at least haloWidth.
+    */
+    static std::unique_ptr<Domain> create(Transport &transport, const FluidParameters &parameters, int rebalanceInterval = 50, float rebalanceTolerance = 0.1f);
+    /*
+    Exchange particles, agree on the time step and advance every rank by it.
+    Collective, returns false if the transport failed.
+    */
+    bool step();
+    Fluid &getFluid() { return *fluid; }
+    const Fluid &getFluid() const { return *fluid; }
+    // owned particles, without ghosts
+    int ownedCount() const { return fluid->particleCount() - ghostCount; }
+    int ghosts() const { return ghostCount; }
+    // size + 1 borders, from -1 to 1
+    const std::vector<float> &getBorders() const { return borders; }
+    float getHaloWidth() const { return haloWidth; }
+    long long migrations() const { return migrated; }
+    int rebalances() const { return rebalanceCount; }
+    /*
+    Sum of the diagnostics of every rank for the latest sampled step, the same on every rank.
+    Sampled every diagnosticsInterval steps of the parameters, false if nothing was sampled yet.
+    */
+    bool getDiagnostics(Diagnostics &sample) const;
+
+private:
+    Transport &transport;
+    std::unique_ptr<Fluid> fluid;
+    float haloWidth;
+    int rebalanceInterval;
+    float rebalanceTolerance;
+    std::vector<float> borders;
+    int ghostCount;
+    long long migrated;
+    int rebalanceCount;
+    bool sampled;
+    Diagnostics combined;
+    Domain(Transport &transport, const FluidParameters &parameters, int rebalanceInterval, float rebalanceTolerance);
+    int ownerOf(float x) const;
+    // borders at the quantiles of a histogram of x over [-1, 1], at least haloWidth apart
+    void placeBorders(const std::vector<long long> &histogram);
+    // this rank's slab of the current borders, the outer ones unbounded
+    void ownedRange(float &begin, float &end) const;
+    bool rebalance();
+    bool migrate();
+    bool exchangeGhosts();
+    bool gatherDiagnostics();
+};
\ No newline at end of file
@@ -1,29 +1,90 @@
 #include "fluid.h"
+#include "profiler.h"
 #include <iostream>
 #include <algorithm>
-#include <glm/gtc/random.hpp>
+#include <cmath>
+#include <limits>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 using namespace glm;
 
-Fluid::Fluid(GLuint instancingShaderID) : renderer(instancingShaderID, transforms, colors, 1), grid(-1, 10000, transforms)
+void FluidParameters::setParticleCount(int n)
 {
-    int nx = 10;
-    int ny = 10;
-    int nz = 10;
+    int side = std::max((int)std::round(std::cbrt((double)n)), 1);
+    int count = side * side * side;
+    float scale = std::cbrt(1000.0f / count);
+    FluidParameters defaults;
+    nx = ny = nz = side;
+    h = defaults.h * scale;
+    skin = defaults.skin * scale;
+    m = defaults.m * 1000.0f / count;
+}
+
+Fluid::Fluid(const FluidParameters &parameters) : Fluid(parameters, -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity())
+{
+}
+
+Fluid::Fluid(const FluidParameters &parameters, float blockBegin, float blockEnd) : pool(parameters.threads), neighbors(4 * parameters.h, parameters.skin), kernel(parameters.h), diagnostics(parameters.diagnosticsInterval), activity(parameters.sleepSteps)
+{
+    int nx = parameters.nx;
+    int ny = parameters.ny;
+    int nz = parameters.nz;
     int n = nx * ny * nz;
-    this->dt = 0.02f;
-    this->simulatedVolume = 1.0f;
-    this->gravity = 0.02f;
-    this->restDensity = 900;
-    this->h = 1.0f / 40;
-    this->displayRaius = 0.05f;
-    this->stiffness = 55;
-    this->damping = 0.3f;
-    this->m = 1.0f;
-    this->grid.size = 2 * h;
-    this->mu = 0.0f;
+    this->parameters = parameters;
+    this->dt = parameters.dt;
+    this->adaptiveTimeStep = parameters.adaptiveTimeStep;
+    this->cfl = parameters.cfl;
+    this->forceFactor = parameters.forceFactor;
+    this->minDt = parameters.minDt;
+    this->time = 0;
+    this->stepCount = 0;
+    this->lastDt = 0;
+    this->maxSpeed = 0;
+    this->maxAcceleration = 0;
+    this->maxDisplacementSquared = 0;
+    this->simulatedVolume = parameters.simulatedVolume;
+    this->gravity = parameters.gravity;
+    this->h = parameters.h;
+    this->stiffness = parameters.stiffness;
+    this->damping = parameters.damping;
+    this->m = parameters.m;
+    this->pressureSolver = parameters.pressureSolver;
+    this->solverIterations = parameters.solverIterations;
+    this->densityTolerance = parameters.densityTolerance;
+    this->relaxation = parameters.relaxation;
+    this->restDensity = pressureSolver == PressureSolver::Implicit && n > 0 ? initialDensity() : parameters.restDensity;
+    this->lastSolverIterations = 0;
+    this->lastSolverError = 0;
+    this->sleepSpeed = parameters.sleepSpeed;
+    this->sleepDensityChange = parameters.sleepDensityChange;
+    this->decomposed = false;
+    this->ownedBegin = -std::numeric_limits<float>::infinity();
+    this->ownedEnd = std::numeric_limits<float>::infinity();
+    this->particlesChanged = false;
+    // W and dW vanish beyond r = 4h, cells must cover that plus the neighbor list skin
+    float cellSize = neighbors.cutoff + neighbors.skin;
+    if (parameters.gridType == GridType::Hash)
+        grid = std::make_unique<HashGrid>(cellSize, parameters.tableSize, particles);
+    else
+        grid = std::make_unique<DenseGrid>(cellSize, vec3(-1), vec3(1), particles);
+    this->mu = parameters.mu;
 
+    // the layers of the block with blockBegin <= x < blockEnd, ids are the index in the whole block
+    auto inBlock = [&](int x)
+    {
+        float position = (float)x / nx - 0.5f;
+        return position >= blockBegin && position < blockEnd;
+    };
+    int layers = 0;
+    for (int x = 0; x < nx; x++)
+        layers += inBlock(x);
+    particles.resize(layers * ny * nz);
+    int i = 0;
     for (int x = 0; x < nx; x++)
     {
+        if (!inBlock(x))
+            continue;
         for (int y = 0; y < ny; y++)
         {
             for (int z = 0; z < nz; z++)
@@ -31,270 +92,681 @@ Fluid::Fluid(GLuint instancingShaderID) : renderer(instancingShaderID, transform
                 float x0 = (float)x / nx;
                 float y0 = (float)y / ny;
                 float z0 = (float)z / nz;
-                transforms.push_back(Transform(vec3(x0, y0, z0) - vec3(0.5f), vec3(0), vec3(displayRaius)));
-                vs.push_back(vec3(0));
-                colors.push_back(vec3(x0, y0, z0));
+                particles.setPosition(i, vec3(x0, y0, z0) - vec3(0.5f));
+                particles.setVelocity(i, vec3(0));
+                particles.id[i] = (x * ny + y) * nz + z;
+                i++;
             }
         }
     }
 }
 
-void Fluid::step()
+float Fluid::initialDensity() const
 {
-    densities.assign(transforms.size(), 0);
-    pressures.assign(transforms.size(), 0);
-    as.assign(transforms.size(), vec3(0));
-    grid.update();
-
-    for (int i = 0; i < transforms.size(); i++)
+    float spacing[3] = {1.0f / parameters.nx, 1.0f / parameters.ny, 1.0f / parameters.nz};
+    float support = neighbors.cutoff;
+    int reach[3];
+    for (int c = 0; c < 3; c++)
+        reach[c] = (int)(support / spacing[c]);
+    float sum = 0;
+    for (int a = -reach[0]; a <= reach[0]; a++)
     {
-        std::vector<int> neighbors = grid.getCell(transforms[i].position);
-        for (int j = 0; j < neighbors.size(); j++)
+        for (int b = -reach[1]; b <= reach[1]; b++)
         {
-            int neighborIndex = neighbors[j];
-            if (neighborIndex < i)
-                continue;
-            vec3 delta = transforms[i].position - transforms[neighborIndex].position;
-            float r = length(delta);
-            // rho[kg/m^3] = m[kg] * W[m^-3]
-            float d = m * W(r, h);
-            densities[i] += d;
-            if (neighborIndex != i)
-                densities[neighborIndex] += d;
+            for (int c = -reach[2]; c <= reach[2]; c++)
+                sum += kernel.W(length(vec3(a * spacing[0], b * spacing[1], c * spacing[2])));
         }
     }
-    float gamma = 1.3f;
+    return m * sum;
+}
+
+float Fluid::computeTimeStep() const
+{
+    if (!adaptiveTimeStep)
+        return dt;
+    float next = dt;
+    if (maxSpeed > 0)
+        next = std::min(next, cfl * h / maxSpeed);
+    if (maxAcceleration > 0)
+        next = std::min(next, forceFactor * std::sqrt(h / maxAcceleration));
+    return std::max(next, minDt);
+}
+
+void Fluid::step()
+{
+    step(computeTimeStep());
+}
+
+int Fluid::advance(double interval, int maxSteps)
+{
+    double target = time + interval;
+    int steps = 0;
+    while (time < target && steps < maxSteps)
+    {
+        float remaining = (float)(target - time);
+        float next = computeTimeStep();
+        // avoid leaving a tiny last step behind
+        if (next >= remaining || remaining - next < 0.1f * next)
+            next = remaining;
+        step(next);
+        if (next == remaining)
+            time = target;
+        steps++;
+    }
+    return steps;
+}
 
-    for (int i = 0; i < transforms.size(); i++)
+void Fluid::setOwnedRange(float begin, float end, float haloWidth)
+{
+    decomposed = true;
+    ownedBegin = begin;
+    ownedEnd = end;
+    // the dense grid only has to cover the slab and its ghosts
+    if (grid->type() == GridType::Dense)
     {
-        // p [Nm^-2 = kgs^-2 m^-1] = k[m^2s^-2] * (rho[kg/m^3] - rho0[kg/m^3])
-        pressures[i] = stiffness * (densities[i] - restDensity);
-        // pressures[i] = stiffness * (pow(densities[i] / restDensity, 1.3) - 1);
+        float cellSize = neighbors.cutoff + neighbors.skin;
+        vec3 lower(std::max(begin - haloWidth, -1.0f), -1, -1);
+        vec3 upper(std::min(end + haloWidth, 1.0f), 1, 1);
+        grid = std::make_unique<DenseGrid>(cellSize, lower, upper, particles);
+        particlesChanged = true;
     }
+}
 
-    for (int i = 0; i < transforms.size(); i++)
+void Fluid::removeParticles(const std::vector<unsigned char> &remove)
+{
+    int n = particles.size();
+    AlignedArray<float> *arrays[] = {&particles.x, &particles.y, &particles.z, &particles.vx, &particles.vy, &particles.vz,
+                                     &particles.ax, &particles.ay, &particles.az, &particles.density, &particles.pressure};
+    int kept = 0;
+    for (int i = 0; i < n; i++)
     {
-        std::vector<int> neighbors = grid.getNeighbors(transforms[i].position);
-        for (int j = 0; j < neighbors.size(); j++)
+        if (remove[i])
+            continue;
+        if (kept != i)
         {
-            int neighborIndex = neighbors[j];
-            if (neighborIndex <= i)
-                continue;
-
-            vec3 dist = transforms[i].position - transforms[neighborIndex].position;
-            float r = length(dist);
-            vec3 direction = normalize(dist);
-            if (r < 1e-5)
-                direction = sphericalRand(1.0f);
-
-            // dP/dx[Nm^-3] = kgm^-1s^-2 * kg^-2m^6 * m^-4
-            // = kg^-1 s^-2 m
-            vec3 pressureGradient = (pressures[i] / densities[i] / densities[i] + pressures[neighborIndex] / densities[neighborIndex] / densities[neighborIndex]) * dW(r, h) * direction;
-            as[i] -= pressureGradient;
-            as[neighborIndex] += pressureGradient;
-            // viscosity
-            vec3 dv = 2 * mu * m / (densities[i] + densities[neighborIndex]) * (vs[neighborIndex] - vs[i]) * dW(r, h);
-            vs[i] += dv * dt;
-            vs[neighborIndex] -= dv * dt;
+            for (AlignedArray<float> *array : arrays)
+                (*array)[kept] = (*array)[i];
+            particles.id[kept] = particles.id[i];
         }
-        as[i] /= densities[i];
-        as[i].y -= gravity;
+        kept++;
     }
+    particles.resize(kept);
+    particleGhost.clear();
+    particlesChanged = true;
+}
 
-    // leapfrog integration
-    for (int i = 0; i < transforms.size(); i++)
-    {
-        // vs[i].z = 0;
-        vs[i] += as[i] * dt;
-        transforms[i].position += vs[i] * dt;
-        // transforms[i].position.z = -0.5f;
-    }
-    float total_energy = 0.0f;
-    for (int i = 0; i < transforms.size(); i++)
+void Fluid::addParticles(const std::vector<ParticleRecord> &records)
+{
+    int n = particles.size();
+    particles.resize(n + (int)records.size());
+    for (const ParticleRecord &record : records)
     {
-        total_energy += 0.5f * m * dot(vs[i], vs[i]);
-        total_energy += m * gravity * (transforms[i].position.y + 1);
+        particles.setPosition(n, vec3(record.x, record.y, record.z));
+        particles.setVelocity(n, vec3(record.vx, record.vy, record.vz));
+        particles.id[n] = record.id;
+        n++;
     }
-    // std::cout << "total energy: " << total_energy << std::endl;
-    applyBoundaries();
+    particleGhost.clear();
+    particlesChanged = true;
 }
 
-float Fluid::W(float r, float h)
+bool Fluid::updateGhosts(const std::vector<ParticleRecord> &records)
 {
-    h *= 2; // to get the radius to be h
-    // https://de.wikipedia.org/wiki/Smoothed_Particle_Hydrodynamics#Kern
-    // 0<=q <=1 : (4-6q^2 + 3q^3)
-    // 1<q <=2 : (2-q)^3
-    // q > 2 : 0
-    // integral of w from -inf to inf has to be 1, correct with factor sigma = 2/9
-    float h3 = h * h * h;
-    float q = r / h;
-
-    float result = 0;
-    if (q <= 1)
+    // the ghosts and the records by id, they have to be the same particles
+    int n = particles.size();
+    std::vector<std::pair<int, int>> ghosts;
+    for (int i = 0; i < n; i++)
     {
-        result = (4 - 6 * q * q + 3 * q * q * q);
+        if (isGhost(i))
+            ghosts.push_back({particles.id[i], i});
     }
-    else
+    if (ghosts.size() != records.size())
+        return false;
+    std::vector<std::pair<int, int>> order(records.size());
+    for (size_t k = 0; k < records.size(); k++)
+        order[k] = {records[k].id, (int)k};
+    std::sort(ghosts.begin(), ghosts.end());
+    std::sort(order.begin(), order.end());
+    for (size_t k = 0; k < ghosts.size(); k++)
     {
-        if (q <= 2)
-        {
-            result = (2 - q) * (2 - q) * (2 - q);
-        }
+        if (ghosts[k].first != order[k].first)
+            return false;
     }
-    return result * 1 / 6 / h3;
-}
 
-float Fluid::dW(float r, float h)
-{
-    h *= 2; // to get the radius to be h
-    // 0<= q <=1 : -12q + 9q^2
-    // h< q <=2 : -3(2-q)^2
-    // q > 2 : 0
-    // always
-    float h4 = h * h * h * h;
-    float q = r / h;
-
-    float result = 0;
-    if (q <= 1)
+    // the ghosts aren't integrated here, so their moves count towards the next rebuild from here
+    bool built = neighbors.builds > 0 && neighbors.rowStart.size() == (size_t)n + 1;
+    for (size_t k = 0; k < ghosts.size(); k++)
     {
-        result = (-12 * q + 9 * q * q);
+        int i = ghosts[k].second;
+        const ParticleRecord &record = records[order[k].second];
+        particles.setPosition(i, vec3(record.x, record.y, record.z));
+        particles.setVelocity(i, vec3(record.vx, record.vy, record.vz));
+        if (built)
+            maxDisplacementSquared = std::max(maxDisplacementSquared, neighbors.displacementSquared(i, record.x, record.y, record.z));
     }
-    else
+    return true;
+}
+
+/*
+Smallest number of particles per task: a task's neighbor rows and particles should fit
+in half of the L2 cache, but every step still gets a few hundred tasks to balance
+*/
+static int blockedTaskSize(const NeighborList &neighbors, int n)
+{
+    static const long long cacheBytes = []
     {
-        if (q <= 2)
-        {
-            result = (-3) * (2 - q) * (2 - q);
-        }
-    }
-    return result * 1 / 6 / h4;
+        long long bytes = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+        bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+        return bytes > 0 ? bytes : 512 * 1024;
+    }();
+    double rowLength = n > 0 ? (double)neighbors.pairCount() / n : 0;
+    // index, distance, direction and gradient of every pair, plus the particle's own arrays
+    double bytesPerParticle = rowLength * 6 * sizeof(float) + 16 * sizeof(float);
+    int size = (int)(cacheBytes / 2 / bytesPerParticle);
+    return std::max(32, std::min(size, n / 256));
 }
 
-void Fluid::applyBoundaries()
+void Fluid::rebuildNeighbors(bool reorder)
 {
-    for (int i = 0; i < transforms.size(); i++)
+    grid->update(pool);
+    if (reorder)
     {
-        if (transforms[i].position.y < -1)
-        {
-            vs[i].y *= -(1 - damping);
-            transforms[i].position.y = -1;
-        }
-        if (transforms[i].position.y > 1)
-        {
-            vs[i].y *= -(1 - damping);
-            transforms[i].position.y = 1;
-        }
-        if (transforms[i].position.x < -1)
-        {
-            transforms[i].position.x = -1;
-            vs[i].x *= -(1 - damping);
-        }
-        if (transforms[i].position.x > 1)
-        {
-            transforms[i].position.x = 1;
-            vs[i].x *= -(1 - damping);
-        }
-        if (transforms[i].position.z < -1)
-        {
-            transforms[i].position.z = -1;
-            vs[i].z *= -(1 - damping);
-        }
-        if (transforms[i].position.z > 1)
-        {
-            transforms[i].position.z = 1;
-            vs[i].z *= -(1 - damping);
-        }
+        reorderParticles();
+        grid->renumber();
     }
+    neighbors.build(*grid, particles, pool);
+    grid->setTaskSize(blockedTaskSize(neighbors, particles.size()));
 }
 
-void Fluid::draw()
+void Fluid::reorderParticles()
 {
-    for (int i = 0; i < densities.size(); i++)
+    SPH_PROFILE_SCOPE("reorder");
+    int n = particles.size();
+    reorderScratch.resize(n);
+    idScratch.resize(n);
+    // acceleration is recomputed before it is read again. Pressure is the implicit solver's initial guess,
+    // sleeping particles keep their density and pressure
+    AlignedArray<float> *arrays[] = {&particles.x, &particles.y, &particles.z, &particles.vx, &particles.vy, &particles.vz, &particles.density, &particles.pressure};
+    for (AlignedArray<float> *array : arrays)
     {
-        float normalized = clamp(densities[i] / restDensity /3,0.0f,1.0f);
-        // float normalized = length(vs[i]) * 5;
-        colors[i] = vec3(normalized, 1 - normalized, 0);
+        const float *from = array->data();
+        float *to = reorderScratch.data();
+        pool.parallelFor(0, n, [&](int begin, int end, int)
+                         {
+            for (int k = begin; k < end; k++)
+                to[k] = from[grid->particleAt(k)]; });
+        array->swap(reorderScratch);
     }
-    renderer.draw();
+    const int *ids = particles.id.data();
+    int *sortedIds = idScratch.data();
+    pool.parallelFor(0, n, [&](int begin, int end, int)
+                     {
+        for (int k = begin; k < end; k++)
+            sortedIds[k] = ids[grid->particleAt(k)]; });
+    particles.id.swap(idScratch);
+}
+
+/*
+Run perParticle(i) for every particle, scheduled over grid cells with work stealing
+*/
+template <typename F>
+static void forEachParticle(ThreadPool &pool, const Grid &grid, F perParticle)
+{
+    pool.parallelForDynamic(grid.taskCount(), [&](int task, int)
+                            {
+        for (int k = grid.taskBegin(task); k < grid.taskEnd(task); k++)
+            perParticle(grid.particleAt(k)); });
+}
+
+/*
+Run perTask(task, thread) for every task of grid cells, with work stealing
+*/
+template <typename F>
+static void forEachTask(ThreadPool &pool, const Grid &grid, F perTask)
+{
+    pool.parallelForDynamic(grid.taskCount(), perTask);
 }
 
-Grid::Grid(float size, int tableSize, std::vector<Transform> &transforms) : size(size), transforms(transforms), tableSize(tableSize)
+// reflect one component at the walls lo and hi
+static inline void reflect(float &p, float &v, float lo, float hi, float restitution)
 {
+    bool outside = p < lo || p > hi;
+    p = p < lo ? lo : (p > hi ? hi : p);
+    v = outside ? v * restitution : v;
 }
 
-void Grid::update()
+/*
+Two or more passes over the particles in cell order with one barrier between each:
+pair update, density and, with the equation of state, pressure, then the pressure solve if it is implicit,
+then forces, integration and boundaries.
+Every pass gathers into particle i only and reads nothing the same pass writes for other particles,
+so the result is the same for any thread count and schedule.
+*/
+void Fluid::step(float dt)
 {
-    // TODO move these to constructor and include their sizes in the constructor. atm not possible as transforms is unititialized in constructor
-    hashs.assign(transforms.size(), 0);
-    sortedHashIndices.assign(transforms.size(), 0);
-    startIndices.assign(tableSize, -1);
-    for (int i = 0; i < transforms.size(); i++)
+    SPH_PROFILE_SCOPE("step");
+    int n = particles.size();
+    float *densities = particles.density.data();
+    float *pressures = particles.pressure.data();
+
+    if (particlesChanged || neighbors.needsRebuild(n, maxDisplacementSquared))
     {
-        hashs[i] = hash(transforms[i].position);
-        sortedHashIndices[i] = i;
+        SPH_PROFILE_SCOPE("neighbor list");
+        rebuildNeighbors(true);
+        particlesChanged = false;
+        // the reordered densities and pressures moved
+        densities = particles.density.data();
+        pressures = particles.pressure.data();
     }
-    std::sort(sortedHashIndices.begin(), sortedHashIndices.end(), [&](int a, int b)
-              { return hashs[a] < hashs[b]; });
-    int lastHash = -1;
-    for (int i = 0; i < transforms.size(); i++)
+    const float *pairDistance = neighbors.pairDistance.data();
+    float *pairGradient = neighbors.pairGradient.data();
+
+    // sleeping particles keep their density and pressure, awake ones note whether theirs still changes
+    bool tracking = activity.enabled();
+    bool sleeping = activity.anyAsleep();
+    if (tracking)
     {
-        if (hashs[sortedHashIndices[i]] != lastHash)
-        {
-            lastHash = hashs[sortedHashIndices[i]];
-            startIndices[lastHash] = i;
-        }
+        activity.resize(grid->bucketCount());
+        densityChanged.resize(n);
+        particleAsleep.resize(n);
     }
+    float densityChangeLimit = sleepDensityChange * restDensity;
+    if (decomposed)
+        particleGhost.resize(n);
+    const float *x = particles.x.data();
+
+    // distances and directions of row i only depend on positions, which this pass doesn't change
+    float selfWeight = kernel.W(0);
+    bool equationOfState = pressureSolver == PressureSolver::EquationOfState;
+    {
+        SPH_PROFILE_SCOPE(equationOfState ? "density and pressure" : "density");
+        forEachParticle(pool, *grid, [&](int i)
+                        {
+            if (decomposed)
+                particleGhost[i] = x[i] < ownedBegin || x[i] >= ownedEnd;
+            if (sleeping)
+            {
+                particleAsleep[i] = activity.asleep(grid->bucketOf(i));
+                if (particleAsleep[i])
+                    return;
+            }
+            neighbors.updateRow(i, particles);
+            int begin = neighbors.begin(i);
+            int count = neighbors.end(i) - begin;
+            // rho[kg/m^3] = m[kg] * W[m^-3], the whole row at once, dW is kept for the force pass
+            float density = m * (selfWeight + kernel.sumWAndGradients(pairDistance + begin, pairGradient + begin, count));
+            if (tracking)
+                densityChanged[i] = std::abs(density - densities[i]) > densityChangeLimit;
+            densities[i] = density;
+            if (equationOfState)
+            {
+                // p [Nm^-2 = kgs^-2 m^-1] = k[m^2s^-2] * (rho[kg/m^3] - rho0[kg/m^3])
+                pressures[i] = stiffness * (density - restDensity);
+                // pressures[i] = stiffness * (pow(density / restDensity, 1.3) - 1);
+            } });
+    }
+
+    // ghosts still needed their density for their owned neighbors, from here on they are left alone
+    int ghosts = decomposed ? (int)std::count(particleGhost.begin(), particleGhost.end(), 1) : 0;
+
+    // Diagnostics are summed per task, the tasks don't depend on the thread count
+    bool sample = diagnostics.beginStep(stepCount, n - ghosts, grid->taskCount());
+    nextVx.resize(n);
+    nextVy.resize(n);
+    nextVz.resize(n);
+    threadMaxSpeed.assign(pool.size(), 0);
+    threadMaxAcceleration.assign(pool.size(), 0);
+    threadMaxDisplacement.assign(pool.size(), 0);
+    if (equationOfState)
+        equationOfStateForces(dt, sample);
+    else
+        implicitPressure(dt, sample);
+    particles.vx.swap(nextVx);
+    particles.vy.swap(nextVy);
+    particles.vz.swap(nextVz);
+    maxSpeed = std::sqrt(*std::max_element(threadMaxSpeed.begin(), threadMaxSpeed.end()));
+    maxAcceleration = std::sqrt(*std::max_element(threadMaxAcceleration.begin(), threadMaxAcceleration.end()));
+    maxDisplacementSquared = *std::max_element(threadMaxDisplacement.begin(), threadMaxDisplacement.end());
+
+    if (tracking)
+        activity.endStep(*grid);
+
+    time += dt;
+    lastDt = dt;
+    stepCount++;
+    if (sample)
+        diagnostics.endStep(stepCount, time, m, gravity, activity.sleepingParticles());
 }
 
-ivec3 Grid::cellIds(vec3 pos)
+// leapfrog integration and boundaries. Positions are not read by the last pass and the new
+// velocities go to the second buffer, the old ones may still be read by neighbors.
+// Sleeping particles stay where they are at rest. Restless particles keep their cell awake,
+// moving ones also wake every cell in their row. A cell that just woke up and finds its density changed
+// stays awake but doesn't wake its neighbors, so waking doesn't spread on its own.
+template <typename F>
+void Fluid::integrateTask(int task, int thread, float dt, bool sample, F velocityOf)
 {
-    return ivec3(pos / size);
+    float *x = particles.x.data();
+    float *y = particles.y.data();
+    float *z = particles.z.data();
+    const float *densities = particles.density.data();
+    float *newVx = nextVx.data();
+    float *newVy = nextVy.data();
+    float *newVz = nextVz.data();
+    float restitution = -(1 - damping);
+    float invRestDensity = 1 / restDensity;
+    float maxSpeedSquared = threadMaxSpeed[thread];
+    float maxDisplacement = threadMaxDisplacement[thread];
+    bool tracking = activity.enabled();
+    bool sleeping = activity.anyAsleep();
+    float sleepSpeedSquared = sleepSpeed * sleepSpeed;
+    DiagnosticsSums sums = {};
+    for (int k = grid->taskBegin(task); k < grid->taskEnd(task); k++)
+    {
+        int i = grid->particleAt(k);
+        // ghosts are moved by their owner
+        if (decomposed && particleGhost[i])
+            continue;
+        int bucket = tracking ? grid->bucketOf(i) : 0;
+        vec3 v(0);
+        vec3 position(x[i], y[i], z[i]);
+        if (!sleeping || !particleAsleep[i])
+        {
+            v = velocityOf(i);
+            position += v * dt;
+            reflect(position.x, v.x, -1, 1, restitution);
+            reflect(position.y, v.y, -1, 1, restitution);
+            reflect(position.z, v.z, -1, 1, restitution);
+            x[i] = position.x;
+            y[i] = position.y;
+            z[i] = position.z;
+            bool moving = dot(v, v) > sleepSpeedSquared;
+            if (tracking && (moving || densityChanged[i]))
+                activity.markRestless(bucket);
+            if (sleeping && moving)
+            {
+                for (int p = neighbors.begin(i); p < neighbors.end(i); p++)
+                {
+                    int j = neighbors.neighbors[p];
+                    if (particleAsleep[j])
+                        activity.requestWake(grid->bucketOf(j));
+                }
+            }
+        }
+        newVx[i] = v.x;
+        newVy[i] = v.y;
+        newVz[i] = v.z;
+
+        // inputs of the next adaptive time step and of the next rebuild check
+        float speedSquared = dot(v, v);
+        maxSpeedSquared = std::max(maxSpeedSquared, speedSquared);
+        maxDisplacement = std::max(maxDisplacement, neighbors.displacementSquared(i, position.x, position.y, position.z));
+        if (sample)
+        {
+            float densityError = std::abs(densities[i] - restDensity) * invRestDensity;
+            sums.speedSquared += speedSquared;
+            sums.height += position.y + 1;
+            sums.densityError += densityError;
+            sums.momentumX += v.x;
+            sums.momentumY += v.y;
+            sums.momentumZ += v.z;
+            sums.maxSpeedSquared = std::max(sums.maxSpeedSquared, speedSquared);
+            sums.maxDensityError = std::max(sums.maxDensityError, densityError);
+        }
+    }
+    if (sample)
+        diagnostics.sumsOf(task) = sums;
+    threadMaxSpeed[thread] = maxSpeedSquared;
+    threadMaxDisplacement[thread] = maxDisplacement;
 }
 
-int Grid::hash(vec3 pos)
+void Fluid::equationOfStateForces(float dt, bool sample)
 {
-    ivec3 ids = cellIds(pos);
-    return abs((ids.x * 92837111) ^ (ids.y * 689287499) ^ (ids.z * 283923481)) % tableSize;
+    SPH_PROFILE_SCOPE("forces and integration");
+    const float *vx = particles.vx.data();
+    const float *vy = particles.vy.data();
+    const float *vz = particles.vz.data();
+    float *ax = particles.ax.data();
+    float *ay = particles.ay.data();
+    float *az = particles.az.data();
+    const float *densities = particles.density.data();
+    const float *pressures = particles.pressure.data();
+    const int *neighborIndices = neighbors.neighbors.data();
+    const float *pairDirX = neighbors.pairDirX.data();
+    const float *pairDirY = neighbors.pairDirY.data();
+    const float *pairDirZ = neighbors.pairDirZ.data();
+    const float *pairGradient = neighbors.pairGradient.data();
+    forEachTask(pool, *grid, [&](int task, int thread)
+                {
+        float maxAccelerationSquared = threadMaxAcceleration[thread];
+        integrateTask(task, thread, dt, sample, [&](int i)
+                      {
+            float pressureTerm = pressures[i] / densities[i] / densities[i];
+            vec3 velocity(vx[i], vy[i], vz[i]);
+            vec3 pressureAcceleration(0);
+            vec3 viscosityAcceleration(0);
+            for (int p = neighbors.begin(i); p < neighbors.end(i); p++)
+            {
+                int neighborIndex = neighborIndices[p];
+                vec3 direction(pairDirX[p], pairDirY[p], pairDirZ[p]);
+                float gradient = pairGradient[p];
+
+                // dP/dx[Nm^-3] = kgm^-1s^-2 * kg^-2m^6 * m^-4
+                // = kg^-1 s^-2 m
+                pressureAcceleration -= (pressureTerm + pressures[neighborIndex] / densities[neighborIndex] / densities[neighborIndex]) * gradient * direction;
+                // viscosity
+                viscosityAcceleration += 2 * mu * m / (densities[i] + densities[neighborIndex]) * (vec3(vx[neighborIndex], vy[neighborIndex], vz[neighborIndex]) - velocity) * gradient;
+            }
+            vec3 acceleration = pressureAcceleration / densities[i] + viscosityAcceleration;
+            acceleration.y -= gravity;
+            ax[i] = acceleration.x;
+            ay[i] = acceleration.y;
+            az[i] = acceleration.z;
+            maxAccelerationSquared = std::max(maxAccelerationSquared, dot(acceleration, acceleration));
+            return velocity + acceleration * dt; });
+        threadMaxAcceleration[thread] = maxAccelerationSquared; });
 }
 
-std::vector<int> Grid::getCell(vec3 pos)
+/*
+IISPH (Ihmsen et al. 2014). With grad_ij = dW(r_ij) * direction_ij:
+advection  v_adv = v + dt a_nonpressure, d_ii = -dt^2 sum_j m / rho_i^2 grad_ij
+prediction rho_adv = rho_i + dt sum_j m (v_adv_i - v_adv_j) . grad_ij, a_ii = sum_j m (d_ii - d_ji) . grad_ij
+then relaxed Jacobi iterations, two passes each:
+           sum_j d_ij p_j = -dt^2 sum_j m / rho_j^2 p_j grad_ij
+           p_i = (1 - w) p_i + w / a_ii (rho0 - rho_adv - sum_j m (sum d_ij p_j - d_jj p_j - (sum d_jk p_k - d_ji p_i)) . grad_ij)
+and v = v_adv + dt a_pressure. Pressures are clamped at 0, so the solver only pushes particles apart.
+Sleeping particles act like static boundary particles: they don't move and their pressure
+is taken as the mirrored p_i / rho_i^2 of the awake neighbor, which moves their d_ij p_j into d_ii.
+*/
+void Fluid::implicitPressure(float dt, bool sample)
 {
-    int index = hash(pos);
-    int start = startIndices[index];
-    std::vector<int> result;
-    if (start == -1)
-        return result;
-    for (int i = start; i < sortedHashIndices.size(); i++)
+    int n = particles.size();
+    const float *vx = particles.vx.data();
+    const float *vy = particles.vy.data();
+    const float *vz = particles.vz.data();
+    float *ax = particles.ax.data();
+    float *ay = particles.ay.data();
+    float *az = particles.az.data();
+    const float *densities = particles.density.data();
+    const int *neighborIndices = neighbors.neighbors.data();
+    const float *pairDirX = neighbors.pairDirX.data();
+    const float *pairDirY = neighbors.pairDirY.data();
+    const float *pairDirZ = neighbors.pairDirZ.data();
+    const float *pairGradient = neighbors.pairGradient.data();
+    AlignedArray<float> *scratch[] = {&diiX, &diiY, &diiZ, &aii, &advectedDensity, &dijPjX, &dijPjY, &dijPjZ, &nextPressure};
+    for (AlignedArray<float> *array : scratch)
+        array->resize(n);
+    float *advectedVx = nextVx.data();
+    float *advectedVy = nextVy.data();
+    float *advectedVz = nextVz.data();
+    float dt2 = dt * dt;
+    bool sleeping = activity.anyAsleep();
+    const unsigned char *asleep = particleAsleep.data();
+    auto frozen = [&](int i)
+    { return sleeping && asleep[i]; };
+
     {
-        if (hashs[sortedHashIndices[i]] != index)
-            break;
-        result.push_back(sortedHashIndices[i]);
+        SPH_PROFILE_SCOPE("advection");
+        forEachTask(pool, *grid, [&](int task, int thread)
+                    {
+            float maxAccelerationSquared = threadMaxAcceleration[thread];
+            for (int k = grid->taskBegin(task); k < grid->taskEnd(task); k++)
+            {
+                int i = grid->particleAt(k);
+                if (frozen(i))
+                {
+                    advectedVx[i] = advectedVy[i] = advectedVz[i] = 0;
+                    continue;
+                }
+                vec3 velocity(vx[i], vy[i], vz[i]);
+                vec3 viscosityAcceleration(0);
+                vec3 gradientSum(0);
+                for (int p = neighbors.begin(i); p < neighbors.end(i); p++)
+                {
+                    int j = neighborIndices[p];
+                    vec3 direction(pairDirX[p], pairDirY[p], pairDirZ[p]);
+                    float gradient = pairGradient[p];
+                    viscosityAcceleration += 2 * mu * m / (densities[i] + densities[j]) * (vec3(vx[j], vy[j], vz[j]) - velocity) * gradient;
+                    // a sleeping neighbor mirrors p_i, its d_ij p_j joins d_ii
+                    gradientSum += (frozen(j) ? 2 * gradient : gradient) * direction;
+                }
+                vec3 acceleration = viscosityAcceleration;
+                acceleration.y -= gravity;
+                ax[i] = acceleration.x;
+                ay[i] = acceleration.y;
+                az[i] = acceleration.z;
+                maxAccelerationSquared = std::max(maxAccelerationSquared, dot(acceleration, acceleration));
+                vec3 advected = velocity + acceleration * dt;
+                advectedVx[i] = advected.x;
+                advectedVy[i] = advected.y;
+                advectedVz[i] = advected.z;
+                vec3 dii = -dt2 * m / (densities[i] * densities[i]) * gradientSum;
+                diiX[i] = dii.x;
+                diiY[i] = dii.y;
+                diiZ[i] = dii.z;
+            }
+            threadMaxAcceleration[thread] = maxAccelerationSquared; });
     }
-    return result;
-}
 
-std::vector<int> Grid::getNeighbors(vec3 pos)
-{
-    // probably incredibly slow to create a vector for every cell for every step
-    std::vector<int> result;
-    for (int x = -1; x < 2; x++)
+    // a_ii of a single neighbor on the steepest part of the kernel. Particles that only touch
+    // the edge of their neighbors' support have a_ii near rounding noise and get no pressure
+    float steepest = kernel.dW(4 * h / 3);
+    float minDiagonal = 1e-4f * dt2 * m * m * steepest * steepest / (restDensity * restDensity);
     {
-        for (int y = -1; y < 2; y++)
-        {
-            for (int z = -1; z < 2; z++)
+        SPH_PROFILE_SCOPE("prediction");
+        float *pressures = particles.pressure.data();
+        forEachParticle(pool, *grid, [&](int i)
+                        {
+            if (frozen(i))
+                return;
+            vec3 advected(advectedVx[i], advectedVy[i], advectedVz[i]);
+            vec3 dii(diiX[i], diiY[i], diiZ[i]);
+            float dji = dt2 * m / (densities[i] * densities[i]);
+            float divergence = 0;
+            float diagonal = 0;
+            for (int p = neighbors.begin(i); p < neighbors.end(i); p++)
             {
-                int cellHash = hash(pos + vec3(x, y, z) * size);
-                int start = startIndices[cellHash];
-                if (start == -1)
+                int j = neighborIndices[p];
+                vec3 gradient = pairGradient[p] * vec3(pairDirX[p], pairDirY[p], pairDirZ[p]);
+                divergence += dot(advected - vec3(advectedVx[j], advectedVy[j], advectedVz[j]), gradient);
+                diagonal += dot(frozen(j) ? dii : dii - dji * gradient, gradient);
+            }
+            advectedDensity[i] = densities[i] + dt * m * divergence;
+            bool coupled = -m * diagonal > minDiagonal;
+            aii[i] = coupled ? m * diagonal : 0;
+            // half of the last step's pressure is a good first guess
+            pressures[i] = coupled ? 0.5f * pressures[i] : 0; });
+    }
+
+    int tasks = grid->taskCount();
+    taskError.assign(tasks, 0);
+    int iteration = 0;
+    float error = 0;
+    while (iteration < solverIterations)
+    {
+        SPH_PROFILE_SCOPE("pressure iteration");
+        const float *pressures = particles.pressure.data();
+        float *newPressures = nextPressure.data();
+        forEachParticle(pool, *grid, [&](int i)
+                        {
+            if (frozen(i))
+                return;
+            vec3 sum(0);
+            for (int p = neighbors.begin(i); p < neighbors.end(i); p++)
+            {
+                int j = neighborIndices[p];
+                if (!frozen(j))
+                    sum -= pressures[j] / (densities[j] * densities[j]) * pairGradient[p] * vec3(pairDirX[p], pairDirY[p], pairDirZ[p]);
+            }
+            sum *= dt2 * m;
+            dijPjX[i] = sum.x;
+            dijPjY[i] = sum.y;
+            dijPjZ[i] = sum.z; });
+        forEachTask(pool, *grid, [&](int task, int)
+                    {
+            double compression = 0;
+            for (int k = grid->taskBegin(task); k < grid->taskEnd(task); k++)
+            {
+                int i = grid->particleAt(k);
+                if (frozen(i))
+                {
+                    newPressures[i] = pressures[i];
                     continue;
-                for (int i = start; i < sortedHashIndices.size(); i++)
+                }
+                vec3 dijPj(dijPjX[i], dijPjY[i], dijPjZ[i]);
+                float dji = dt2 * m / (densities[i] * densities[i]);
+                float pi = pressures[i];
+                float sum = 0;
+                for (int p = neighbors.begin(i); p < neighbors.end(i); p++)
                 {
-                    if (hashs[sortedHashIndices[i]] != cellHash)
-                        break;
-                    result.push_back(sortedHashIndices[i]);
+                    int j = neighborIndices[p];
+                    vec3 gradient = pairGradient[p] * vec3(pairDirX[p], pairDirY[p], pairDirZ[p]);
+                    if (frozen(j))
+                    {
+                        sum += dot(dijPj, gradient);
+                        continue;
+                    }
+                    // sum_k!=i d_jk p_k, with d_ji = dt^2 m / rho_i^2 grad_ij
+                    vec3 djkPk = vec3(dijPjX[j], dijPjY[j], dijPjZ[j]) - dji * pi * gradient;
+                    sum += dot(dijPj - vec3(diiX[j], diiY[j], diiZ[j]) * pressures[j] - djkPk, gradient);
                 }
+                sum *= m;
+                float predicted = advectedDensity[i] + aii[i] * pi + sum;
+                compression += std::max(predicted - restDensity, 0.0f);
+                float next = aii[i] != 0 ? (1 - relaxation) * pi + relaxation / aii[i] * (restDensity - advectedDensity[i] - sum) : 0;
+                newPressures[i] = std::max(next, 0.0f);
             }
-        }
+            taskError[task] = compression; });
+        particles.pressure.swap(nextPressure);
+        iteration++;
+
+        double total = 0;
+        for (double e : taskError)
+            total += e;
+        error = n > 0 ? (float)(total / n / restDensity) : 0;
+        if (iteration >= 2 && error <= densityTolerance)
+            break;
     }
-    return result;
+    lastSolverIterations = iteration;
+    lastSolverError = error;
+
+    SPH_PROFILE_SCOPE("pressure forces and integration");
+    const float *pressures = particles.pressure.data();
+    forEachTask(pool, *grid, [&](int task, int thread)
+                { integrateTask(task, thread, dt, sample, [&](int i)
+                                {
+            float pressureTerm = pressures[i] / (densities[i] * densities[i]);
+            vec3 pressureAcceleration(0);
+            for (int p = neighbors.begin(i); p < neighbors.end(i); p++)
+            {
+                int j = neighborIndices[p];
+                float neighborTerm = frozen(j) ? pressureTerm : pressures[j] / (densities[j] * densities[j]);
+                pressureAcceleration -= m * (pressureTerm + neighborTerm) * pairGradient[p] * vec3(pairDirX[p], pairDirY[p], pairDirZ[p]);
+            }
+            ax[i] += pressureAcceleration.x;
+            ay[i] += pressureAcceleration.y;
+            az[i] += pressureAcceleration.z;
+            return vec3(advectedVx[i], advectedVy[i], advectedVz[i]) + pressureAcceleration * dt; }); });
 }
\ No newline at end of file
@@ -1,59 +1,236 @@
 #pragma once
+#include <memory>
 #include <vector>
 
 #include <glm/glm.hpp>
 
-#include "RenderObject.h"
+#include "cellActivity.h"
+#include "diagnostics.h"
+#include "grid.h"
+#include "kernel.h"
+#include "neighborList.h"
+#include "particles.h"
+#include "threadPool.h"
 
-class Grid
+/*
+How pressures are found every step
+EquationOfState: p = stiffness * (rho - rho0), weakly compressible, needs small time steps and a tuned stiffness.
+Implicit: IISPH, relaxed Jacobi iterations for the pressures that bring the predicted density back to rho0.
+Costs a few passes per iteration but stays incompressible at much larger time steps.
+*/
+enum class PressureSolver
 {
-public:
-    float size;
-    int tableSize;
-    Grid(float size, int tableSize, std::vector<Transform> &transforms);
-    void update();
+    EquationOfState,
+    Implicit
+};
+
+/*
+Simulation parameters, the defaults are the ones the viewer has always used
+*/
+struct FluidParameters
+{
+    // initial block of nx * ny * nz particles filling [-0.5, 0.5)^3
+    int nx = 10;
+    int ny = 10;
+    int nz = 10;
+    // fixed time step, or the largest step the adaptive controller may take
+    float dt = 0.02f;
+    // pick every step from the CFL and force criteria instead of using dt
+    bool adaptiveTimeStep = false;
+    // dt <= cfl * h / max speed
+    float cfl = 0.4f;
+    // dt <= forceFactor * sqrt(h / max acceleration)
+    float forceFactor = 0.25f;
+    float minDt = 1e-4f;
+    float simulatedVolume = 1.0f;
+    float gravity = 0.02f;
+    // rest density of the equation of state. The implicit solver keeps the initial spacing instead,
+    // its rest density is the density inside the initial block
+    float restDensity = 900;
+    float h = 1.0f / 40;
+    float stiffness = 55;
+    float damping = 0.3f;
+    float m = 1.0f;
+    float mu = 0.0f;
+    PressureSolver pressureSolver = PressureSolver::EquationOfState;
+    // implicit solver: iterate until the mean compression is below densityTolerance * rho0, at most solverIterations times
+    int solverIterations = 100;
+    float densityTolerance = 0.001f;
+    // Jacobi relaxation factor of the implicit solver
+    float relaxation = 0.5f;
+    GridType gridType = GridType::Dense;
+    // bucket count of the hash grid
+    int tableSize = 10000;
+    // extra neighbor search distance, the neighbor list is rebuilt once a particle moved half of it
+    float skin = 0.01f;
+    // worker threads, <= 0 uses all hardware threads
+    int threads = 0;
     /*
-    Get indices of all particles in the same cell and the 26 surrounding cells
+    Cells whose particles stayed slower than sleepSpeed and changed their density by less than
+    sleepDensityChange * rho0 per step for sleepSteps steps go to sleep: they are frozen but still
+    count as neighbors, until a restless particle comes within reach. 0 never sleeps.
     */
-    std::vector<int> getNeighbors(glm::vec3 pos);
-    std::vector<int> getCell(glm::vec3 pos);
-
-private:
-    std::vector<Transform> &transforms;
-    std::vector<int> hashs;
-    std::vector<int> sortedHashIndices;
-    std::vector<int> startIndices;
-    int hash(glm::vec3 pos);
-    glm::ivec3 cellIds(glm::vec3 pos);
+    int sleepSteps = 0;
+    float sleepSpeed = 0.002f;
+    float sleepDensityChange = 1e-4f;
+    // sample Diagnostics every N steps, 0 only on request
+    int diagnosticsInterval = 0;
+    /*
+    Round n to a cube of particles and scale h, skin and m with the particle spacing,
+    keeping the neighbor count and the density of the 10 x 10 x 10 block
+    */
+    void setParticleCount(int n);
 };
 
+/*
+The solver state, independent of any rendering
+*/
 class Fluid
 {
 public:
-    Fluid(GLuint instancingShaderID);
+    Fluid(const FluidParameters &parameters = FluidParameters());
+    /*
+    Create only the particles of the initial block with blockBegin <= x < blockEnd, e.g. the slab of one process
+    of a decomposed run. Ids are still the index in the whole block.
+    */
+    Fluid(const FluidParameters &parameters, float blockBegin, float blockEnd);
+    /*
+    Advance by one time step, picked by computeTimeStep if the time step is adaptive
+    */
     void step();
-    void draw();
+    // advance by exactly dt, e.g. the step every process of a decomposed run agreed on
+    void step(float dt);
+    /*
+    Advance by interval simulated seconds in substeps, the last one is shortened to end exactly on the interval.
+    Stops early after maxSteps substeps. Returns the number of substeps taken.
+    */
+    int advance(double interval, int maxSteps = 1000);
+    /*
+    Largest stable step from the maximum speed and acceleration of the last step,
+    clamped to [minDt, dt]. Returns dt for a fixed time step.
+    The implicit solver adapts its pressures to the step, so only the other accelerations count there.
+    */
+    float computeTimeStep() const;
+    double getTime() const { return time; }
+    float getLastTimeStep() const { return lastDt; }
+    float getMaxSpeed() const { return maxSpeed; }
+    int particleCount() const { return particles.size(); }
+    int threadCount() const { return pool.size(); }
+    int neighborListBuilds() const { return neighbors.builds; }
+    float getRestDensity() const { return restDensity; }
+    long long getStepCount() const { return stepCount; }
+    PressureSolver getPressureSolver() const { return pressureSolver; }
+    // iterations and remaining mean compression / rho0 of the last implicit solve
+    int getSolverIterations() const { return lastSolverIterations; }
+    float getSolverDensityError() const { return lastSolverError; }
+    // particles in sleeping cells after the last step
+    int sleepingParticles() const { return activity.sleepingParticles(); }
+    /*
+    Diagnostics are summed inside the integration pass of sampled steps only,
+    every diagnosticsInterval steps or at the next step after a request.
+    getDiagnostics returns the newest sample and may be called from any thread.
+    */
+    void setDiagnosticsInterval(int steps) { diagnostics.setInterval(steps); }
+    void requestDiagnostics() { diagnostics.request(); }
+    bool getDiagnostics(Diagnostics &sample) const { return diagnostics.latest(sample); }
+    const Particles &getParticles() const { return particles; }
+    const FluidParameters &getParameters() const { return parameters; }
+    /*
+    Subdomain of a decomposed run (see Domain): particles whose x is outside [begin, end) when a step starts
+    are ghosts, copies of particles another process owns. They count as neighbors but aren't integrated
+    and stay out of the diagnostics and the time step. The dense grid is narrowed to the range and haloWidth
+    around it, every call rebuilds the neighbor list.
+    */
+    void setOwnedRange(float begin, float end, float haloWidth);
+    // whether particle i was a ghost in the last step, until particles are added or removed
+    bool isGhost(int i) const { return i < (int)particleGhost.size() && particleGhost[i]; }
+    // drop every particle i with remove[i] != 0, keeping the order of the others
+    void removeParticles(const std::vector<unsigned char> &remove);
+    void addParticles(const std::vector<ParticleRecord> &records);
+    /*
+    Move the ghosts of the last step to the positions and velocities of the records with their ids.
+    The neighbor list is kept until the moves add up to its skin. Returns false and changes nothing
+    unless the records are exactly the current ghosts, in any order.
+    */
+    bool updateGhosts(const std::vector<ParticleRecord> &records);
 
 private:
+    friend class Checkpoint;
+    // as constructed, kept for checkpoints
+    FluidParameters parameters;
     float dt;
+    bool adaptiveTimeStep;
+    float cfl;
+    float forceFactor;
+    float minDt;
+    double time;
+    long long stepCount;
+    float lastDt;
+    float maxSpeed;
+    float maxAcceleration;
+    std::vector<float> threadMaxSpeed;
+    std::vector<float> threadMaxAcceleration;
+    // largest squared distance a particle moved since the last neighbor list build, found by the force pass
+    float maxDisplacementSquared;
+    std::vector<float> threadMaxDisplacement;
     float simulatedVolume;
     float gravity;
     float restDensity;
     float h;
-    float displayRaius;
     float stiffness;
     float damping;
     float m;
     float mu;
-    std::vector<Transform> transforms;
-    std::vector<glm::vec3> colors;
-    std::vector<glm::vec3> vs;
-    std::vector<float> densities;
-    std::vector<float> pressures;
-    std::vector<glm::vec3> as;
-    SpheresRenderer renderer;
-    Grid grid;
-    float W(float r, float h);
-    float dW(float r, float h);
-    void applyBoundaries();
+    PressureSolver pressureSolver;
+    int solverIterations;
+    float densityTolerance;
+    float relaxation;
+    int lastSolverIterations;
+    float lastSolverError;
+    Particles particles;
+    ThreadPool pool;
+    std::unique_ptr<Grid> grid;
+    NeighborList neighbors;
+    Kernel kernel;
+    DiagnosticsCollector diagnostics;
+    CellActivity activity;
+    float sleepSpeed;
+    float sleepDensityChange;
+    // set by the density pass: whether an awake particle's density still changes, and whether a particle sleeps
+    std::vector<unsigned char> densityChanged;
+    std::vector<unsigned char> particleAsleep;
+    bool decomposed;
+    float ownedBegin, ownedEnd;
+    // set by the density pass of a decomposed run
+    std::vector<unsigned char> particleGhost;
+    // particles were added or removed, the neighbor list must be rebuilt
+    bool particlesChanged;
+    // the force pass writes the new velocities here while other particles still read the old ones
+    AlignedArray<float> nextVx, nextVy, nextVz;
+    // implicit solver state: d_ii, a_ii, the density after advection, sum_j d_ij p_j and the next Jacobi iterate
+    AlignedArray<float> diiX, diiY, diiZ;
+    AlignedArray<float> aii;
+    AlignedArray<float> advectedDensity;
+    AlignedArray<float> dijPjX, dijPjY, dijPjZ;
+    AlignedArray<float> nextPressure;
+    // compression summed per grid task, added up in task order
+    std::vector<double> taskError;
+    AlignedArray<float> reorderScratch;
+    AlignedArray<int> idScratch;
+    void equationOfStateForces(float dt, bool sample);
+    void implicitPressure(float dt, bool sample);
+    /*
+    Integration and boundaries of the particles of one task, at the end of the last pass of a step.
+    velocityOf(i) returns the new velocity, written to nextV. Keeps the maxima of the thread and the diagnostics sums.
+    */
+    template <typename F>
+    void integrateTask(int task, int thread, float dt, bool sample, F velocityOf);
+    /*
+    Sort the grid and build the neighbor list. With reorder the particles are first
+    permuted into grid order, so every task of cells is a contiguous range of memory.
+    */
+    void rebuildNeighbors(bool reorder);
+    void reorderParticles();
+    // m * sum W over the lattice of the initial block, around a particle away from its faces
+    float initialDensity() const;
 };
\ No newline at end of file
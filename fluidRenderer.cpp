@@ -0,0 +1,41 @@
+#include "fluidRenderer.h"
+#include "profiler.h"
+
+#include <algorithm>
+
+using namespace glm;
+
+FluidRenderer::FluidRenderer(GLuint particleShaderID, GLuint impostorShaderID, int particleCount, float displayRadius)
+    : displayRadius(displayRadius), spheres(particleShaderID, particleCount, vec3(-1), vec3(1), 1),
+      impostorSpheres(impostorShaderID, particleCount, vec3(-1), vec3(1))
+{
+}
+
+void FluidRenderer::draw(const Snapshot &snapshot)
+{
+    draw(snapshot, snapshot, 1);
+}
+
+void FluidRenderer::draw(const Snapshot &previous, const Snapshot &current, float alpha)
+{
+    SPH_PROFILE_SCOPE("fluid draw");
+    // 8 bytes per particle go into the mapped buffer, the colormap is applied in the shader
+    ParticleRenderer &renderer = impostors ? (ParticleRenderer &)impostorSpheres : (ParticleRenderer &)spheres;
+    ParticleInstance *instances = renderer.mapInstances();
+    // the buffer holds the particle count the renderer was made for, a larger snapshot is cut off
+    int count = std::min(current.size(), renderer.capacity());
+    {
+        SPH_PROFILE_SCOPE("instance packing");
+        bool interpolate = previous.size() == current.size() && alpha < 1;
+        const std::vector<float> &values = colorMode == ColorMode::Density ? current.density : current.speed;
+        for (int i = 0; i < count; i++)
+        {
+            vec3 position = interpolate ? mix(previous.position(i), current.position(i), alpha) : current.position(i);
+            instances[i] = renderer.makeInstance(position, values[i]);
+        }
+    }
+    if (colorMode == ColorMode::Density)
+        renderer.draw(count, displayRadius, 0, 3 * current.restDensity);
+    else
+        renderer.draw(count, displayRadius, 0, maxDisplaySpeed);
+}
\ No newline at end of file
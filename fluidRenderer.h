@@ -0,0 +1,37 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "RenderObject.h"
+#include "snapshot.h"
+
+enum class ColorMode
+{
+    Density,
+    Speed
+};
+
+/*
+Draws particle snapshots as instanced spheres or sphere impostors in the compact
+instance format, colored by density or speed in the shader
+*/
+class FluidRenderer
+{
+public:
+    ColorMode colorMode = ColorMode::Density;
+    // speed mapped to the top of the colormap
+    float maxDisplaySpeed = 0.2f;
+    // ray cast impostors instead of icosphere meshes
+    bool impostors = true;
+    FluidRenderer(GLuint particleShaderID, GLuint impostorShaderID, int particleCount, float displayRadius = 0.05f);
+    void draw(const Snapshot &snapshot);
+    /*
+    Draw positions interpolated between two snapshots, alpha = 0 is previous and 1 is current
+    */
+    void draw(const Snapshot &previous, const Snapshot &current, float alpha);
+
+private:
+    float displayRadius;
+    ParticleSpheresRenderer spheres;
+    ParticleImpostorRenderer impostorSpheres;
+};
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include "frameCapture.h"
+
+#include <string.h>
+
+FrameCapture::FrameCapture(int width, int height, int bufferCount)
+    : width(width), height(height), frameCount(0), packBuffers(bufferCount), fences(bufferCount, (GLsync)0), frameIndices(bufferCount, -1)
+{
+    glGenRenderbuffers(1, &colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(bufferCount, packBuffers.data());
+    for (GLuint buffer : packBuffers)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+FrameCapture::~FrameCapture()
+{
+    for (GLsync sync : fences)
+    {
+        if (sync)
+            glDeleteSync(sync);
+    }
+    glDeleteBuffers((GLsizei)packBuffers.size(), packBuffers.data());
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &colorBuffer);
+    glDeleteRenderbuffers(1, &depthBuffer);
+}
+
+void FrameCapture::bind()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+}
+
+void FrameCapture::capture(ImageWriter &writer)
+{
+    int slot = frameCount % packBuffers.size();
+    if (fences[slot])
+        retire(slot, writer);
+
+    // with a pack buffer bound glReadPixels returns right away, the copy runs on the GPU
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffers[slot]);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frameIndices[slot] = frameCount;
+    frameCount++;
+}
+
+void FrameCapture::flush(ImageWriter &writer)
+{
+    // oldest first, so the images are queued in order
+    for (int i = 0; i < (int)packBuffers.size(); i++)
+    {
+        int slot = (frameCount + i) % packBuffers.size();
+        if (fences[slot])
+            retire(slot, writer);
+    }
+}
+
+void FrameCapture::retire(int slot, ImageWriter &writer)
+{
+    while (glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+    {
+    }
+    glDeleteSync(fences[slot]);
+    fences[slot] = 0;
+
+    Image image;
+    image.index = frameIndices[slot];
+    image.width = width;
+    image.height = height;
+    image.pixels.resize((size_t)width * height * 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffers[slot]);
+    void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, image.pixels.size(), GL_MAP_READ_BIT);
+    if (mapped)
+    {
+        memcpy(image.pixels.data(), mapped, image.pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    writer.write(std::move(image));
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+
+#include "imageWriter.h"
+
+/*
+Framebuffer object to render frames into, read back asynchronously through a ring of
+pixel pack buffers. capture() only queues the copy on the GPU; a frame is mapped and
+handed to the ImageWriter bufferCount - 1 frames later, when the copy has long finished.
+*/
+class FrameCapture
+{
+public:
+    int width;
+    int height;
+    FrameCapture(int width, int height, int bufferCount = 3);
+    ~FrameCapture();
+    FrameCapture(const FrameCapture &) = delete;
+    FrameCapture &operator=(const FrameCapture &) = delete;
+    // render into the framebuffer from here on, also sets the viewport
+    void bind();
+    // start reading back what was rendered since bind, writes out the oldest pending frame if the ring is full
+    void capture(ImageWriter &writer);
+    // write out all pending frames
+    void flush(ImageWriter &writer);
+    bool isComplete() const { return complete; }
+
+private:
+    GLuint framebuffer;
+    GLuint colorBuffer;
+    GLuint depthBuffer;
+    bool complete;
+    int frameCount;
+    std::vector<GLuint> packBuffers;
+    std::vector<GLsync> fences;
+    std::vector<int> frameIndices;
+    void retire(int slot, ImageWriter &writer);
+};
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include "grid.h"
+#include "profiler.h"
+#include <algorithm>
+
+using namespace glm;
+
+// bucket blocks per thread in Grid::update
+static const int blocksPerThread = 4;
+
+Grid::Grid(float size, const Particles &particles) : size(size), taskSize(64), particles(particles), taskStart(1, 0)
+{
+}
+
+void Grid::update(ThreadPool &pool)
+{
+    SPH_PROFILE_SCOPE("grid update");
+    int n = particles.size();
+    int threads = pool.size();
+    int buckets = bucketCount();
+    // contiguous blocks of buckets, a few per thread so the block sorts balance
+    int blockSize = (buckets + threads * blocksPerThread - 1) / (threads * blocksPerThread);
+    int blocks = (buckets + blockSize - 1) / blockSize;
+    keys.resize(n);
+    sortedIndices.resize(n);
+    blockOrder.resize(n);
+    bucketStart.resize(buckets + 1);
+    blockStart.resize(blocks + 1);
+    blockOffsets.resize((size_t)threads * blocks);
+
+    // find buckets and count per thread and block
+    pool.parallelFor(0, n, [&](int begin, int end, int thread)
+                     {
+        int *counts = &blockOffsets[(size_t)thread * blocks];
+        std::fill(counts, counts + blocks, 0);
+        for (int i = begin; i < end; i++)
+        {
+            keys[i] = bucket(particles.position(i));
+            counts[keys[i] / blockSize]++;
+        } });
+
+    // turn the per thread counts into scatter offsets, lower threads first within a block to keep index order
+    int offset = 0;
+    for (int b = 0; b < blocks; b++)
+    {
+        blockStart[b] = offset;
+        for (int t = 0; t < threads; t++)
+        {
+            int &slot = blockOffsets[(size_t)t * blocks + b];
+            int count = slot;
+            slot = offset;
+            offset += count;
+        }
+    }
+    blockStart[blocks] = n;
+
+    pool.parallelFor(0, n, [&](int begin, int end, int thread)
+                     {
+        int *offsets = &blockOffsets[(size_t)thread * blocks];
+        for (int i = begin; i < end; i++)
+            blockOrder[offsets[keys[i] / blockSize]++] = i; });
+
+    // counting sort of every block over its own buckets. The counts become bucket ends,
+    // scattering backwards moves them to the bucket starts and keeps index order
+    pool.parallelForDynamic(blocks, [&](int block, int)
+                            {
+        int first = block * blockSize;
+        int last = std::min(first + blockSize, buckets);
+        std::fill(bucketStart.begin() + first, bucketStart.begin() + last, 0);
+        for (int k = blockStart[block]; k < blockStart[block + 1]; k++)
+            bucketStart[keys[blockOrder[k]]]++;
+        int end = blockStart[block];
+        for (int b = first; b < last; b++)
+        {
+            end += bucketStart[b];
+            bucketStart[b] = end;
+        }
+        for (int k = blockStart[block + 1] - 1; k >= blockStart[block]; k--)
+        {
+            int i = blockOrder[k];
+            sortedIndices[--bucketStart[keys[i]]] = i;
+        } });
+    bucketStart[buckets] = n;
+
+    splitTasks();
+}
+
+void Grid::renumber()
+{
+    for (int k = 0; k < (int)sortedIndices.size(); k++)
+        sortedIndices[k] = k;
+    for (int b = 0; b + 1 < (int)bucketStart.size(); b++)
+    {
+        for (int k = bucketStart[b]; k < bucketStart[b + 1]; k++)
+            keys[k] = b;
+    }
+}
+
+void Grid::setTaskSize(int particles)
+{
+    taskSize = particles;
+    splitTasks();
+}
+
+void Grid::splitTasks()
+{
+    int n = (int)sortedIndices.size();
+    taskStart.assign(1, 0);
+    for (int b = 0; b + 1 < (int)bucketStart.size(); b++)
+    {
+        if (bucketStart[b + 1] - taskStart.back() >= taskSize)
+            taskStart.push_back(bucketStart[b + 1]);
+    }
+    if (taskStart.back() != n)
+        taskStart.push_back(n);
+}
+
+std::vector<int> Grid::getCell(vec3 pos) const
+{
+    std::vector<int> result;
+    forEachInCell(pos, [&](int index)
+                  { result.push_back(index); });
+    return result;
+}
+
+std::vector<int> Grid::getNeighbors(vec3 pos) const
+{
+    std::vector<int> result;
+    forEachNeighbor(pos, [&](int index)
+                    { result.push_back(index); });
+    return result;
+}
+
+HashGrid::HashGrid(float size, int tableSize, const Particles &particles) : Grid(size, particles), tableSize(tableSize)
+{
+}
+
+ivec3 HashGrid::cellIds(vec3 pos) const
+{
+    return ivec3(pos / size);
+}
+
+int HashGrid::bucket(vec3 pos) const
+{
+    ivec3 ids = cellIds(pos);
+    return abs((ids.x * 92837111) ^ (ids.y * 689287499) ^ (ids.z * 283923481)) % tableSize;
+}
+
+int HashGrid::neighborBuckets(vec3 pos, int buckets[27]) const
+{
+    int count = 0;
+    for (int x = -1; x < 2; x++)
+    {
+        for (int y = -1; y < 2; y++)
+        {
+            for (int z = -1; z < 2; z++)
+            {
+                int candidate = bucket(pos + vec3(x, y, z) * size);
+                // unrelated cells can share a bucket, don't count their particles twice
+                bool duplicate = false;
+                for (int k = 0; k < count; k++)
+                    duplicate |= buckets[k] == candidate;
+                if (!duplicate)
+                    buckets[count++] = candidate;
+            }
+        }
+    }
+    return count;
+}
+
+DenseGrid::DenseGrid(float size, vec3 lower, vec3 upper, const Particles &particles) : Grid(size, particles), lower(lower), upper(upper)
+{
+    dims = max(ivec3(1), ivec3(ceil((upper - lower) / size)));
+}
+
+ivec3 DenseGrid::cellIds(vec3 pos) const
+{
+    return clamp(ivec3(floor((pos - lower) / size)), ivec3(0), dims - 1);
+}
+
+int DenseGrid::bucket(vec3 pos) const
+{
+    ivec3 ids = cellIds(pos);
+    return (ids.z * dims.y + ids.y) * dims.x + ids.x;
+}
+
+int DenseGrid::neighborBuckets(vec3 pos, int buckets[27]) const
+{
+    // stencil clipped to the box, no two cells share a bucket so nothing to deduplicate
+    ivec3 ids = cellIds(pos);
+    ivec3 from = max(ids - 1, ivec3(0));
+    ivec3 to = min(ids + 1, dims - 1);
+    int count = 0;
+    for (int z = from.z; z <= to.z; z++)
+    {
+        for (int y = from.y; y <= to.y; y++)
+        {
+            for (int x = from.x; x <= to.x; x++)
+                buckets[count++] = (z * dims.y + y) * dims.x + x;
+        }
+    }
+    return count;
+}
\ No newline at end of file
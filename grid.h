@@ -0,0 +1,158 @@
+#pragma once
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "particles.h"
+#include "threadPool.h"
+
+enum class GridType
+{
+    // unbounded, cells are hashed into a fixed number of buckets
+    Hash,
+    // bounded box with exactly one bucket per cell
+    Dense
+};
+
+/*
+Uniform grid of cubic cells, particles are sorted into buckets with a counting sort.
+Backends only differ in how a cell is mapped to a bucket.
+*/
+class Grid
+{
+public:
+    float size;
+    // minimum number of particles per task, tasks always cover whole buckets
+    int taskSize;
+    Grid(float size, const Particles &particles);
+    virtual ~Grid() {}
+    virtual GridType type() const = 0;
+    /*
+    Rebuild the buckets with a parallel two level counting sort, by contiguous blocks of buckets
+    and then by bucket within every block, so the scratch memory grows with the particles
+    and the threads, not with threads * buckets.
+    Particles within a bucket stay in index order, independent of the thread count.
+    */
+    void update(ThreadPool &pool);
+    /*
+    The particles were permuted into the order of the last update, the particle at sorted
+    position k is now particle k
+    */
+    void renumber();
+    // change the minimum task size and split the current buckets into tasks again
+    void setTaskSize(int particles);
+    /*
+    Call visit(index) for every particle in the same cell and the 26 surrounding cells.
+    Every bucket is visited at most once. Does not allocate.
+    */
+    template <typename F>
+    void forEachNeighbor(glm::vec3 pos, F &&visit) const;
+    /*
+    Call visit(index) for every particle in the cell of pos
+    */
+    template <typename F>
+    void forEachInCell(glm::vec3 pos, F &&visit) const;
+    /*
+    Get indices of all particles in the same cell and the 26 surrounding cells
+    */
+    std::vector<int> getNeighbors(glm::vec3 pos) const;
+    std::vector<int> getCell(glm::vec3 pos) const;
+    /*
+    Tasks for parallel loops over the particles in cell order, task t covers
+    particleAt(taskBegin(t)) to particleAt(taskEnd(t) - 1)
+    */
+    int taskCount() const { return (int)taskStart.size() - 1; }
+    int taskBegin(int task) const { return taskStart[task]; }
+    int taskEnd(int task) const { return taskStart[task + 1]; }
+    int particleAt(int sortedIndex) const { return sortedIndices[sortedIndex]; }
+    // buckets of the last update, for state kept per cell
+    virtual int bucketCount() const = 0;
+    int bucketOf(int particle) const { return keys[particle]; }
+    int bucketSize(int bucket) const { return bucketStart[bucket + 1] - bucketStart[bucket]; }
+
+protected:
+    const Particles &particles;
+    // bucket of the cell containing pos, valid for every particle position
+    virtual int bucket(glm::vec3 pos) const = 0;
+    // distinct buckets of the cell containing pos and its 26 neighbors, returns how many
+    virtual int neighborBuckets(glm::vec3 pos, int buckets[27]) const = 0;
+
+private:
+    std::vector<int> keys;
+    std::vector<int> sortedIndices;
+    // particles of bucket b are sortedIndices[bucketStart[b]] to sortedIndices[bucketStart[b + 1] - 1]
+    std::vector<int> bucketStart;
+    // update sorts by block of buckets first, then every block on its own:
+    // the particles grouped by block, where each block starts in them, and per thread block counts and scatter offsets
+    std::vector<int> blockOrder;
+    std::vector<int> blockStart;
+    std::vector<int> blockOffsets;
+    std::vector<int> taskStart;
+    void splitTasks();
+    template <typename F>
+    void forEachInBucket(int bucket, F &&visit) const;
+};
+
+/*
+Cells are XOR-hashed into tableSize buckets, unrelated cells can share a bucket
+*/
+class HashGrid : public Grid
+{
+public:
+    int tableSize;
+    HashGrid(float size, int tableSize, const Particles &particles);
+    GridType type() const override { return GridType::Hash; }
+    int bucketCount() const override { return tableSize; }
+
+protected:
+    int bucket(glm::vec3 pos) const override;
+    int neighborBuckets(glm::vec3 pos, int buckets[27]) const override;
+
+private:
+    glm::ivec3 cellIds(glm::vec3 pos) const;
+};
+
+/*
+One bucket per cell of the box [lower, upper], cells are found with floor so
+every cell has the same width. Positions outside the box are clamped to the border cells.
+*/
+class DenseGrid : public Grid
+{
+public:
+    glm::vec3 lower;
+    glm::vec3 upper;
+    DenseGrid(float size, glm::vec3 lower, glm::vec3 upper, const Particles &particles);
+    GridType type() const override { return GridType::Dense; }
+    int bucketCount() const override { return dims.x * dims.y * dims.z; }
+
+protected:
+    int bucket(glm::vec3 pos) const override;
+    int neighborBuckets(glm::vec3 pos, int buckets[27]) const override;
+
+private:
+    glm::ivec3 dims;
+    glm::ivec3 cellIds(glm::vec3 pos) const;
+};
+
+template <typename F>
+void Grid::forEachInBucket(int bucket, F &&visit) const
+{
+    int end = bucketStart[bucket + 1];
+    for (int i = bucketStart[bucket]; i < end; i++)
+        visit(sortedIndices[i]);
+}
+
+template <typename F>
+void Grid::forEachInCell(glm::vec3 pos, F &&visit) const
+{
+    forEachInBucket(bucket(pos), visit);
+}
+
+template <typename F>
+void Grid::forEachNeighbor(glm::vec3 pos, F &&visit) const
+{
+    int buckets[27];
+    int count = neighborBuckets(pos, buckets);
+    for (int k = 0; k < count; k++)
+        forEachInBucket(buckets[k], visit);
+}
\ No newline at end of file
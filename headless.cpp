@@ -0,0 +1,475 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "checkpoint.h"
+#include "fluid.h"
+#include "perfCounters.h"
+#include "profiler.h"
+#include "trajectory.h"
+
+using namespace std;
+
+static void printUsage(const char *program)
+{
+    cout << "usage: " << program << " [options]\n"
+         << "  --particles N     total particle count, rounded to a cube (default 1000)\n"
+         << "  --block X Y Z     particle block dimensions instead of --particles\n"
+         << "  --steps N         number of timed steps (default 1000)\n"
+         << "  --warmup N        untimed steps before measuring (default 10)\n"
+         << "  --time T          advance T simulated seconds instead of a step count\n"
+         << "  --dt F            time step, upper bound with --adaptive\n"
+         << "  --adaptive        adaptive CFL time step\n"
+         << "  --cfl F           CFL number of the adaptive time step\n"
+         << "  --h F             smoothing length\n"
+         << "  --gravity F\n"
+         << "  --rest-density F\n"
+         << "  --stiffness F\n"
+         << "  --solver eos|iisph pressure from the equation of state or the implicit solver (default eos)\n"
+         << "  --iterations N    implicit solver iterations at most (default 100)\n"
+         << "  --tolerance F     implicit solver mean density error to stop at, fraction of the rest density (default 0.001)\n"
+         << "  --sleep-steps K   cells that stayed quiet for K steps sleep until disturbed (default 0, never)\n"
+         << "  --sleep-speed F   quiet below this speed (default 0.002)\n"
+         << "  --sleep-density F quiet below this density change per step, fraction of the rest density (default 1e-4)\n"
+         << "  --damping F\n"
+         << "  --mass F\n"
+         << "  --mu F            viscosity\n"
+         << "  --grid hash|dense grid backend (default dense)\n"
+         << "  --table-size N    hash grid table size\n"
+         << "  --skin F          neighbor list skin distance\n"
+         << "  --threads N       worker threads (default: all hardware threads)\n"
+         << "  --load PATH       start from a checkpoint, other options override its parameters\n"
+         << "  --save PATH       write a checkpoint at the end\n"
+         << "  --trajectory PATH record the timed steps to a trajectory file\n"
+         << "  --trajectory-stride N  record every N-th step (default 10)\n"
+         << "  --keyframes N     trajectory frames between keyframes (default 100)\n"
+         << "  --check-trajectory  decode the trajectory at the end and compare its last frame with the recorded state\n"
+         << "  --profile         print the time of every phase per step\n"
+         << "  --trace PATH      write the timed steps as Chrome trace JSON\n"
+         << "  --counters        hardware counters per phase and thread (Linux perf_event_open), implies --profile\n"
+         << "  --diagnostics N   print energies, max speed, density error and momentum every N steps\n"
+         << "--particles rounds to a cube and scales h, skin and mass with the spacing, later options override them.\n";
+}
+
+// per step and per thread, misses per thousand instructions
+static void printCounters(Profiler &profiler)
+{
+    unsigned mask = profiler.counterMask();
+    int frames = max(profiler.frameCount(), 1);
+    auto printCounts = [&](const string &label, const PerfCounts &counts)
+    {
+        const uint64_t *values = counts.values;
+        cout << label;
+        for (int e = 0; e < PerfCounters::eventCount; e++)
+        {
+            if (!(mask & 1u << e))
+                continue;
+            cout << "  " << PerfCounters::eventName(e) << " " << values[e] / frames;
+            if (e != PerfCounters::Cycles && e != PerfCounters::Instructions && values[PerfCounters::Instructions])
+                cout << " (" << 1000.0 * values[e] / values[PerfCounters::Instructions] << "/kinst)";
+        }
+        if ((mask & 3u) == 3u && values[PerfCounters::Cycles])
+            cout << "  IPC " << (double)values[PerfCounters::Instructions] / values[PerfCounters::Cycles];
+        cout << endl;
+    };
+    cout << "hardware counters (per step, summed over threads):" << endl;
+    for (const Profiler::Phase &phase : profiler.getPhases())
+    {
+        if (!phase.counted)
+            continue;
+        string indent(phase.depth * 2 + 2, ' ');
+        printCounts(indent + phase.name + ":", phase.counts);
+        for (int thread = 0; thread < (int)phase.threadCounts.size(); thread++)
+        {
+            if (phase.threadCounts[thread].values[PerfCounters::Cycles] || phase.threadCounts[thread].values[PerfCounters::Instructions])
+                printCounts(indent + "  " + profiler.threadName(thread) + ":", phase.threadCounts[thread]);
+        }
+    }
+}
+
+static void captureFrame(const Fluid &fluid, TrajectoryFrame &frame)
+{
+    const Particles &particles = fluid.getParticles();
+    int n = particles.size();
+    frame.time = fluid.getTime();
+    const float *components[trajectoryComponents] = {
+        particles.x.data(), particles.y.data(), particles.z.data(),
+        particles.vx.data(), particles.vy.data(), particles.vz.data(),
+        particles.density.data()};
+    vector<float> *targets[trajectoryComponents] = {&frame.x, &frame.y, &frame.z, &frame.vx, &frame.vy, &frame.vz, &frame.density};
+    for (int c = 0; c < trajectoryComponents; c++)
+    {
+        // the trajectory is in id order
+        targets[c]->resize(n);
+        for (int i = 0; i < n; i++)
+            (*targets[c])[particles.id[i]] = components[c][i];
+    }
+}
+
+/*
+Decode every frame of a trajectory and compare the one recorded at the time of expected with it.
+Every value has to be within half a quantization step of its frame's range. Prints the result,
+returns false if the file does not round trip.
+*/
+static bool checkTrajectory(const string &path, int framesWritten, const TrajectoryFrame &expected)
+{
+    TrajectoryReader reader(path);
+    if (!reader.isOpen())
+        return false;
+    TrajectoryFrame frame;
+    int frames = 0;
+    bool compared = false;
+    double worst = 0;
+    while (reader.next(frame))
+    {
+        frames++;
+        if (frame.time != expected.time)
+            continue;
+        compared = true;
+        const vector<float> *decoded[trajectoryComponents] = {&frame.x, &frame.y, &frame.z, &frame.vx, &frame.vy, &frame.vz, &frame.density};
+        const vector<float> *original[trajectoryComponents] = {&expected.x, &expected.y, &expected.z, &expected.vx, &expected.vy, &expected.vz, &expected.density};
+        for (int c = 0; c < trajectoryComponents; c++)
+        {
+            const vector<float> &values = *original[c];
+            if (decoded[c]->size() != values.size())
+                return false;
+            if (values.empty())
+                continue;
+            auto range = minmax_element(values.begin(), values.end());
+            double step = ((double)*range.second - *range.first) / 65535;
+            for (size_t i = 0; i < values.size(); i++)
+            {
+                double error = fabs((double)(*decoded[c])[i] - values[i]);
+                worst = max(worst, step > 0 ? error / step : (error > 0 ? HUGE_VAL : 0));
+            }
+        }
+    }
+    if (frames != framesWritten)
+    {
+        cerr << path << " decodes to " << frames << " frames, " << framesWritten << " were written" << endl;
+        return false;
+    }
+    if (!compared)
+    {
+        cout << "trajectory check: " << frames << " frames decoded, the last recorded frame was dropped" << endl;
+        return true;
+    }
+    cout << "trajectory check: " << frames << " frames decoded, last frame within " << worst << " quantization steps" << endl;
+    // a little above one half for the float rounding of the decoded values
+    if (worst > 0.51)
+    {
+        cerr << path << " does not decode to the recorded values" << endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    FluidParameters parameters;
+    int steps = 1000;
+    int warmup = 10;
+    double simulatedTime = 0;
+    string loadPath;
+    string savePath;
+    string trajectoryPath;
+    TrajectoryOptions trajectoryOptions;
+    bool trajectoryCheck = false;
+    bool profile = false;
+    bool counters = false;
+    int diagnosticsInterval = 0;
+    string tracePath;
+
+    // the checkpoint parameters come first so every other option can override them
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (string(argv[i]) == "--load")
+        {
+            loadPath = argv[i + 1];
+            if (!Checkpoint::readParameters(loadPath, parameters))
+                return 1;
+        }
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        // every option takes at least one value
+        auto value = [&](int offset = 1) -> const char *
+        {
+            if (i + offset >= argc)
+            {
+                cerr << "missing value for " << arg << endl;
+                exit(1);
+            }
+            return argv[i + offset];
+        };
+        if (arg == "--particles")
+            parameters.setParticleCount((int)atof(value())), i++;
+        else if (arg == "--block")
+        {
+            parameters.nx = atoi(value(1));
+            parameters.ny = atoi(value(2));
+            parameters.nz = atoi(value(3));
+            i += 3;
+        }
+        else if (arg == "--steps")
+            steps = atoi(value()), i++;
+        else if (arg == "--warmup")
+            warmup = atoi(value()), i++;
+        else if (arg == "--time")
+            simulatedTime = atof(value()), i++;
+        else if (arg == "--adaptive")
+            parameters.adaptiveTimeStep = true;
+        else if (arg == "--cfl")
+            parameters.cfl = (float)atof(value()), i++;
+        else if (arg == "--dt")
+            parameters.dt = (float)atof(value()), i++;
+        else if (arg == "--h")
+            parameters.h = (float)atof(value()), i++;
+        else if (arg == "--gravity")
+            parameters.gravity = (float)atof(value()), i++;
+        else if (arg == "--rest-density")
+            parameters.restDensity = (float)atof(value()), i++;
+        else if (arg == "--stiffness")
+            parameters.stiffness = (float)atof(value()), i++;
+        else if (arg == "--solver")
+        {
+            string solver = value();
+            if (solver == "eos")
+                parameters.pressureSolver = PressureSolver::EquationOfState;
+            else if (solver == "iisph")
+                parameters.pressureSolver = PressureSolver::Implicit;
+            else
+            {
+                cerr << "unknown solver " << solver << endl;
+                return 1;
+            }
+            i++;
+        }
+        else if (arg == "--iterations")
+            parameters.solverIterations = max(atoi(value()), 1), i++;
+        else if (arg == "--tolerance")
+            parameters.densityTolerance = (float)atof(value()), i++;
+        else if (arg == "--sleep-steps")
+            parameters.sleepSteps = atoi(value()), i++;
+        else if (arg == "--sleep-speed")
+            parameters.sleepSpeed = (float)atof(value()), i++;
+        else if (arg == "--sleep-density")
+            parameters.sleepDensityChange = (float)atof(value()), i++;
+        else if (arg == "--damping")
+            parameters.damping = (float)atof(value()), i++;
+        else if (arg == "--mass")
+            parameters.m = (float)atof(value()), i++;
+        else if (arg == "--mu")
+            parameters.mu = (float)atof(value()), i++;
+        else if (arg == "--table-size")
+            parameters.tableSize = atoi(value()), i++;
+        else if (arg == "--grid")
+        {
+            string type = value();
+            if (type == "hash")
+                parameters.gridType = GridType::Hash;
+            else if (type == "dense")
+                parameters.gridType = GridType::Dense;
+            else
+            {
+                cerr << "unknown grid " << type << endl;
+                return 1;
+            }
+            i++;
+        }
+        else if (arg == "--skin")
+            parameters.skin = (float)atof(value()), i++;
+        else if (arg == "--threads")
+            parameters.threads = atoi(value()), i++;
+        else if (arg == "--load")
+            i++;
+        else if (arg == "--save")
+            savePath = value(), i++;
+        else if (arg == "--check-trajectory")
+            trajectoryCheck = true;
+        else if (arg == "--trajectory")
+            trajectoryPath = value(), i++;
+        else if (arg == "--trajectory-stride")
+            trajectoryOptions.stride = atoi(value()), i++;
+        else if (arg == "--keyframes")
+            trajectoryOptions.keyframeInterval = atoi(value()), i++;
+        else if (arg == "--profile")
+            profile = true;
+        else if (arg == "--trace")
+            tracePath = value(), i++;
+        else if (arg == "--counters")
+            counters = profile = true;
+        else if (arg == "--diagnostics")
+            diagnosticsInterval = atoi(value()), i++;
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            cerr << "unknown option " << arg << endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    unique_ptr<Fluid> instance;
+    if (!loadPath.empty())
+    {
+        instance = Checkpoint::load(loadPath, parameters);
+        if (!instance)
+            return 1;
+    }
+    else
+        instance = make_unique<Fluid>(parameters);
+    Fluid &fluid = *instance;
+    fluid.setDiagnosticsInterval(diagnosticsInterval);
+    int n = fluid.particleCount();
+    cout << "particles: " << n << endl;
+    cout << "threads: " << fluid.threadCount() << endl;
+    cout << "kernel: " << Kernel::isaName() << endl;
+    if (simulatedTime > 0)
+        cout << "simulated time: " << simulatedTime << " s (+" << warmup << " warmup steps)" << endl;
+    else
+        cout << "steps: " << steps << " (+" << warmup << " warmup)" << endl;
+
+    for (int i = 0; i < warmup; i++)
+        fluid.step();
+    // every step is a profiler frame, drained so the per thread rings never overflow
+    bool profiling = profile || !tracePath.empty();
+    if (profiling)
+    {
+        Profiler::global.setThreadName("main");
+        // the phases only start counting from here
+        Profiler::global.reset();
+    }
+    if (counters && !Profiler::global.enableCounters())
+        counters = false;
+    if (!tracePath.empty())
+        Profiler::global.startTrace();
+
+    unique_ptr<TrajectoryWriter> trajectory;
+    if (!trajectoryPath.empty())
+    {
+        trajectory = make_unique<TrajectoryWriter>(trajectoryPath, n, trajectoryOptions);
+        if (!trajectory->isOpen())
+            return 1;
+    }
+
+    // the state of the last recorded frame, for --check-trajectory
+    TrajectoryFrame lastRecorded;
+    auto record = [&]()
+    {
+        if (!trajectory)
+            return;
+        int recorded = trajectory->framesRecorded();
+        trajectory->record(fluid);
+        if (trajectoryCheck && trajectory->framesRecorded() != recorded)
+            captureFrame(fluid, lastRecorded);
+    };
+
+    double startTime = fluid.getTime();
+    auto start = chrono::steady_clock::now();
+    // prints the sample a step took, if it took one
+    long long printed = -1;
+    auto printDiagnostics = [&]()
+    {
+        Diagnostics sample;
+        if (diagnosticsInterval <= 0 || !fluid.getDiagnostics(sample) || sample.step == printed)
+            return;
+        printed = sample.step;
+        cout << "step " << sample.step << " t " << sample.time
+             << " energy " << sample.totalEnergy() << " (kinetic " << sample.kineticEnergy << ", potential " << sample.potentialEnergy << ")"
+             << " max speed " << sample.maxSpeed
+             << " density error " << sample.meanDensityError << " mean " << sample.maxDensityError << " max"
+             << " momentum " << sample.momentum.x << " " << sample.momentum.y << " " << sample.momentum.z;
+        if (fluid.getParameters().sleepSteps > 0)
+            cout << " sleeping " << sample.sleepingParticles;
+        if (fluid.getPressureSolver() == PressureSolver::Implicit)
+            cout << " solver iterations " << fluid.getSolverIterations() << " error " << fluid.getSolverDensityError();
+        cout << endl;
+    };
+    if (simulatedTime > 0 && !trajectory && !profiling && diagnosticsInterval <= 0)
+        steps = fluid.advance(simulatedTime, INT32_MAX);
+    else if (simulatedTime > 0)
+    {
+        // one substep at a time so every step can be recorded
+        double target = startTime + simulatedTime;
+        steps = 0;
+        while (fluid.getTime() < target)
+        {
+            steps += fluid.advance(target - fluid.getTime(), 1);
+            record();
+            if (profiling)
+                Profiler::global.endFrame();
+            printDiagnostics();
+        }
+    }
+    else
+    {
+        for (int i = 0; i < steps; i++)
+        {
+            fluid.step();
+            record();
+            if (profiling)
+                Profiler::global.endFrame();
+            printDiagnostics();
+        }
+    }
+    auto end = chrono::steady_clock::now();
+
+    double seconds = chrono::duration<double>(end - start).count();
+    double stepsPerSecond = steps / seconds;
+    double nsPerParticleStep = seconds * 1e9 / ((double)steps * n);
+    cout << "time: " << seconds << " s" << endl;
+    cout << "steps/s: " << stepsPerSecond << endl;
+    cout << "ns/particle-step: " << nsPerParticleStep << endl;
+    cout << "neighbor list builds: " << fluid.neighborListBuilds() << endl;
+    if (fluid.getParameters().sleepSteps > 0)
+        cout << "sleeping particles: " << fluid.sleepingParticles() << endl;
+    if (fluid.getPressureSolver() == PressureSolver::Implicit)
+        cout << "last pressure solve: " << fluid.getSolverIterations() << " iterations, density error " << fluid.getSolverDensityError() << endl;
+    if (parameters.adaptiveTimeStep || simulatedTime > 0)
+    {
+        double simulated = fluid.getTime() - startTime;
+        cout << "steps taken: " << steps << endl;
+        cout << "steps per simulated second: " << steps / simulated << endl;
+    }
+    if (profile)
+    {
+        cout << "phases (ms/step, summed over threads):" << endl;
+        for (const Profiler::Phase &phase : Profiler::global.getPhases())
+            cout << "  " << string(phase.depth * 2, ' ') << phase.name << ": " << phase.total / max(Profiler::global.frameCount(), 1) << endl;
+    }
+    if (counters)
+        printCounters(Profiler::global);
+    if (!tracePath.empty() && Profiler::global.stopTrace(tracePath))
+        cout << "trace: " << tracePath << endl;
+    if (trajectory)
+    {
+        if (!trajectory->close())
+            return 1;
+        double rawBytes = (double)trajectory->framesWritten() * n * trajectoryComponents * sizeof(float);
+        cout << "trajectory frames: " << trajectory->framesWritten() << " written, " << trajectory->framesDropped() << " dropped" << endl;
+        cout << "trajectory size: " << trajectory->bytesWritten() << " bytes (" << trajectory->bytesWritten() / rawBytes * 100 << "% of raw floats)" << endl;
+        if (trajectoryCheck && !checkTrajectory(trajectoryPath, trajectory->framesWritten(), lastRecorded))
+            return 1;
+    }
+    if (!savePath.empty())
+    {
+        auto saveStart = chrono::steady_clock::now();
+        if (!Checkpoint::save(fluid, savePath))
+            return 1;
+        cout << "checkpoint: " << savePath << " (" << chrono::duration<double>(chrono::steady_clock::now() - saveStart).count() << " s)" << endl;
+    }
+    return 0;
+}
\ No newline at end of file
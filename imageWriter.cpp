@@ -0,0 +1,207 @@
+#include "imageWriter.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <filesystem>
+#include <iostream>
+
+using namespace std;
+
+static const char *extension(ImageFormat format)
+{
+    switch (format)
+    {
+    case ImageFormat::Raw:
+        return ".raw";
+    case ImageFormat::Ppm:
+        return ".ppm";
+    default:
+        return ".png";
+    }
+}
+
+static uint32_t crc32(uint32_t crc, const unsigned char *data, size_t size)
+{
+    static uint32_t table[256];
+    static bool initialized = false;
+    if (!initialized)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        initialized = true;
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void putBigEndian(vector<unsigned char> &out, uint32_t value)
+{
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void writeChunk(FILE *file, const char *type, const vector<unsigned char> &data)
+{
+    vector<unsigned char> chunk;
+    putBigEndian(chunk, (uint32_t)data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    // the crc covers type and data
+    putBigEndian(chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+    fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+// RGB8 rows top to bottom as a PNG with stored (uncompressed) deflate blocks
+static void writePng(FILE *file, int width, int height, const vector<unsigned char> &rgb)
+{
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, 8, file);
+
+    vector<unsigned char> header;
+    putBigEndian(header, width);
+    putBigEndian(header, height);
+    // 8 bit RGB, deflate, adaptive filtering, no interlace
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    writeChunk(file, "IHDR", header);
+
+    // every row starts with filter type 0
+    size_t rowSize = (size_t)width * 3;
+    vector<unsigned char> raw;
+    raw.reserve((rowSize + 1) * height);
+    for (int y = 0; y < height; y++)
+    {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgb.begin() + y * rowSize, rgb.begin() + (y + 1) * rowSize);
+    }
+
+    vector<unsigned char> zlib = {0x78, 0x01};
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    for (size_t offset = 0; offset == 0 || offset < raw.size(); offset += 65535)
+    {
+        size_t size = min<size_t>(65535, raw.size() - offset);
+        bool last = offset + size == raw.size();
+        zlib.insert(zlib.end(), {(unsigned char)last, (unsigned char)size, (unsigned char)(size >> 8), (unsigned char)~size, (unsigned char)(~size >> 8)});
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+    }
+    uint32_t a = 1, b = 0;
+    for (unsigned char c : raw)
+    {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+    putBigEndian(zlib, b << 16 | a);
+    writeChunk(file, "IDAT", zlib);
+    writeChunk(file, "IEND", {});
+}
+
+ImageWriter::ImageWriter(const string &prefix, ImageFormat format, int maxQueued)
+    : prefix(prefix), format(format), maxQueued(maxQueued), written(0), stopping(false)
+{
+    filesystem::path directory = filesystem::path(prefix).parent_path();
+    if (!directory.empty())
+        filesystem::create_directories(directory);
+    thread = std::thread(&ImageWriter::run, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queued.notify_one();
+    thread.join();
+}
+
+void ImageWriter::write(Image image)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        dequeued.wait(lock, [&]
+                      { return (int)queue.size() < maxQueued; });
+        queue.push_back(std::move(image));
+    }
+    queued.notify_one();
+}
+
+int ImageWriter::imagesWritten()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return written;
+}
+
+void ImageWriter::run()
+{
+    while (true)
+    {
+        Image image;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queued.wait(lock, [&]
+                        { return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+            image = std::move(queue.front());
+            queue.pop_front();
+        }
+        dequeued.notify_one();
+        bool saved = save(image);
+        std::lock_guard<std::mutex> lock(mutex);
+        written += saved;
+    }
+}
+
+bool ImageWriter::save(const Image &image)
+{
+    char number[16];
+    snprintf(number, sizeof(number), "_%05d", image.index);
+    string path = prefix + number + extension(format);
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        cerr << "Can't open " << path << endl;
+        return false;
+    }
+
+    // OpenGL rows go bottom to top, files top to bottom
+    size_t rowSize = (size_t)image.width * 4;
+    if (format == ImageFormat::Raw)
+    {
+        for (int y = image.height - 1; y >= 0; y--)
+            fwrite(image.pixels.data() + y * rowSize, 1, rowSize, file);
+    }
+    else
+    {
+        vector<unsigned char> rgb((size_t)image.width * image.height * 3);
+        unsigned char *out = rgb.data();
+        for (int y = image.height - 1; y >= 0; y--)
+        {
+            const unsigned char *in = image.pixels.data() + y * rowSize;
+            for (int x = 0; x < image.width; x++, in += 4, out += 3)
+            {
+                out[0] = in[0];
+                out[1] = in[1];
+                out[2] = in[2];
+            }
+        }
+        if (format == ImageFormat::Ppm)
+        {
+            fprintf(file, "P6\n%d %d\n255\n", image.width, image.height);
+            fwrite(rgb.data(), 1, rgb.size(), file);
+        }
+        else
+            writePng(file, image.width, image.height, rgb);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
\ No newline at end of file
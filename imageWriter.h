@@ -0,0 +1,58 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class ImageFormat
+{
+    // RGBA8 pixels, rows top to bottom, no header
+    Raw,
+    Ppm,
+    // uncompressed, trades file size for not spending time on deflate
+    Png
+};
+
+/*
+RGBA8 image as read back from OpenGL, rows bottom to top
+*/
+struct Image
+{
+    int index = 0;
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;
+};
+
+/*
+Writes numbered image files (prefix_00000.png, ...) on a background thread
+*/
+class ImageWriter
+{
+public:
+    ImageWriter(const std::string &prefix, ImageFormat format, int maxQueued = 8);
+    // writes the images still queued before returning
+    ~ImageWriter();
+    /*
+    Queue an image for writing, only blocks while maxQueued images are waiting,
+    that is when the disk can't keep up
+    */
+    void write(Image image);
+    int imagesWritten();
+
+private:
+    std::string prefix;
+    ImageFormat format;
+    int maxQueued;
+    int written;
+    bool stopping;
+    std::deque<Image> queue;
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable dequeued;
+    std::thread thread;
+    void run();
+    bool save(const Image &image);
+};
\ No newline at end of file
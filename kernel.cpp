@@ -0,0 +1,246 @@
+#include "kernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SPH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC compiles intrinsics for any instruction set without extra flags
+#if defined(SPH_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SPH_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SPH_TARGET(isa)
+#endif
+
+struct KernelConstants
+{
+    float invH;
+    float wScale;
+    float dWScale;
+};
+
+static float sumScalar(const KernelConstants &c, const float *r, float *gradients, int n)
+{
+    float sum = 0;
+    for (int i = 0; i < n; i++)
+    {
+        float q = r[i] * c.invH;
+        float outer = std::max(2 - q, 0.0f);
+        float inner = std::max(1 - q, 0.0f);
+        sum += outer * outer * outer - 4 * inner * inner * inner;
+        if (gradients)
+            gradients[i] = c.dWScale * (12 * inner * inner - 3 * outer * outer);
+    }
+    return c.wScale * sum;
+}
+
+#ifdef SPH_X86
+
+SPH_TARGET("sse2")
+static float sumSSE(const KernelConstants &c, const float *r, float *gradients, int n)
+{
+    const __m128 invH = _mm_set1_ps(c.invH);
+    const __m128 dWScale = _mm_set1_ps(c.dWScale);
+    const __m128 one = _mm_set1_ps(1);
+    const __m128 two = _mm_set1_ps(2);
+    const __m128 three = _mm_set1_ps(3);
+    const __m128 four = _mm_set1_ps(4);
+    const __m128 twelve = _mm_set1_ps(12);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 sum = zero;
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 q = _mm_mul_ps(_mm_loadu_ps(r + i), invH);
+        __m128 outer = _mm_max_ps(_mm_sub_ps(two, q), zero);
+        __m128 inner = _mm_max_ps(_mm_sub_ps(one, q), zero);
+        __m128 outer2 = _mm_mul_ps(outer, outer);
+        __m128 inner2 = _mm_mul_ps(inner, inner);
+        sum = _mm_add_ps(sum, _mm_sub_ps(_mm_mul_ps(outer2, outer), _mm_mul_ps(four, _mm_mul_ps(inner2, inner))));
+        if (gradients)
+            _mm_storeu_ps(gradients + i, _mm_mul_ps(dWScale, _mm_sub_ps(_mm_mul_ps(twelve, inner2), _mm_mul_ps(three, outer2))));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    float total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    return c.wScale * total + sumScalar(c, r + i, gradients ? gradients + i : nullptr, n - i);
+}
+
+SPH_TARGET("avx2,fma")
+static float sumAVX2(const KernelConstants &c, const float *r, float *gradients, int n)
+{
+    const __m256 invH = _mm256_set1_ps(c.invH);
+    const __m256 dWScale = _mm256_set1_ps(c.dWScale);
+    const __m256 one = _mm256_set1_ps(1);
+    const __m256 two = _mm256_set1_ps(2);
+    const __m256 minusThree = _mm256_set1_ps(-3);
+    const __m256 minusFour = _mm256_set1_ps(-4);
+    const __m256 twelve = _mm256_set1_ps(12);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 sum = zero;
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 q = _mm256_mul_ps(_mm256_loadu_ps(r + i), invH);
+        __m256 outer = _mm256_max_ps(_mm256_sub_ps(two, q), zero);
+        __m256 inner = _mm256_max_ps(_mm256_sub_ps(one, q), zero);
+        __m256 outer2 = _mm256_mul_ps(outer, outer);
+        __m256 inner2 = _mm256_mul_ps(inner, inner);
+        // outer^3 - 4 inner^3
+        sum = _mm256_add_ps(sum, _mm256_fmadd_ps(_mm256_mul_ps(minusFour, inner2), inner, _mm256_mul_ps(outer2, outer)));
+        if (gradients)
+            _mm256_storeu_ps(gradients + i, _mm256_mul_ps(dWScale, _mm256_fmadd_ps(twelve, inner2, _mm256_mul_ps(minusThree, outer2))));
+    }
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, half);
+    float total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    return c.wScale * total + sumScalar(c, r + i, gradients ? gradients + i : nullptr, n - i);
+}
+
+SPH_TARGET("avx512f")
+static float sumAVX512(const KernelConstants &c, const float *r, float *gradients, int n)
+{
+    const __m512 invH = _mm512_set1_ps(c.invH);
+    const __m512 dWScale = _mm512_set1_ps(c.dWScale);
+    const __m512 one = _mm512_set1_ps(1);
+    const __m512 two = _mm512_set1_ps(2);
+    const __m512 minusThree = _mm512_set1_ps(-3);
+    const __m512 minusFour = _mm512_set1_ps(-4);
+    const __m512 twelve = _mm512_set1_ps(12);
+    const __m512 zero = _mm512_setzero_ps();
+    __m512 sum = zero;
+    for (int i = 0; i < n; i += 16)
+    {
+        // the tail is handled with a lane mask, masked out lanes load r = 0 and are not added
+        __mmask16 mask = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        __m512 q = _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, r + i), invH);
+        // the zero-masked forms, the plain ones leave GCC 12 warning about the undefined source they pass
+        __m512 outer = _mm512_maskz_max_ps(mask, _mm512_sub_ps(two, q), zero);
+        __m512 inner = _mm512_maskz_max_ps(mask, _mm512_sub_ps(one, q), zero);
+        __m512 outer2 = _mm512_mul_ps(outer, outer);
+        __m512 inner2 = _mm512_mul_ps(inner, inner);
+        sum = _mm512_mask_add_ps(sum, mask, sum, _mm512_fmadd_ps(_mm512_mul_ps(minusFour, inner2), inner, _mm512_mul_ps(outer2, outer)));
+        if (gradients)
+            _mm512_mask_storeu_ps(gradients + i, mask, _mm512_mul_ps(dWScale, _mm512_fmadd_ps(twelve, inner2, _mm512_mul_ps(minusThree, outer2))));
+    }
+    // the tree of _mm512_reduce_add_ps, which has the same warning: halves, quarters, then the last four lanes
+    float lanes[16];
+    _mm512_storeu_ps(lanes, sum);
+    float quarters[4];
+    for (int k = 0; k < 4; k++)
+        quarters[k] = (lanes[k] + lanes[k + 8]) + (lanes[k + 4] + lanes[k + 12]);
+    float total = (quarters[0] + quarters[2]) + (quarters[1] + quarters[3]);
+    return c.wScale * total;
+}
+
+static KernelIsa detectIsa()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool avx2 = false;
+    bool avx512 = false;
+    if (osxsave && maxLeaf >= 7)
+    {
+        unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+        avx2 = fma && (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+        avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+    }
+#else
+    __builtin_cpu_init();
+    bool sse2 = __builtin_cpu_supports("sse2");
+    bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    bool avx512 = __builtin_cpu_supports("avx512f");
+#endif
+    if (avx512)
+        return KernelIsa::AVX512;
+    if (avx2)
+        return KernelIsa::AVX2;
+    if (sse2)
+        return KernelIsa::SSE;
+    return KernelIsa::Scalar;
+}
+
+#else
+
+static KernelIsa detectIsa()
+{
+    return KernelIsa::Scalar;
+}
+
+#endif
+
+using SumFunction = float (*)(const KernelConstants &, const float *, float *, int);
+
+static KernelIsa supportedIsa = detectIsa();
+static KernelIsa activeIsa = supportedIsa;
+
+static SumFunction sumFunction(KernelIsa isa)
+{
+    switch (isa)
+    {
+#ifdef SPH_X86
+    case KernelIsa::AVX512:
+        return sumAVX512;
+    case KernelIsa::AVX2:
+        return sumAVX2;
+    case KernelIsa::SSE:
+        return sumSSE;
+#endif
+    default:
+        return sumScalar;
+    }
+}
+
+static SumFunction activeSum = sumFunction(activeIsa);
+
+Kernel::Kernel(float h) : h(h)
+{
+    float h2 = 2 * h; // to get the radius to be h
+    invH = 1 / h2;
+    // integral of w from -inf to inf has to be 1, correct with factor sigma = 2/9
+    wScale = 1 / (6 * h2 * h2 * h2);
+    dWScale = 1 / (6 * h2 * h2 * h2 * h2);
+}
+
+float Kernel::sumWAndGradients(const float *r, float *gradients, int n) const
+{
+    KernelConstants constants = {invH, wScale, dWScale};
+    return activeSum(constants, r, gradients, n);
+}
+
+KernelIsa Kernel::isa()
+{
+    return activeIsa;
+}
+
+const char *Kernel::isaName()
+{
+    switch (activeIsa)
+    {
+    case KernelIsa::AVX512:
+        return "avx512";
+    case KernelIsa::AVX2:
+        return "avx2";
+    case KernelIsa::SSE:
+        return "sse";
+    default:
+        return "scalar";
+    }
+}
+
+void Kernel::setIsa(KernelIsa isa)
+{
+    activeIsa = std::min(isa, supportedIsa);
+    activeSum = sumFunction(activeIsa);
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+#include <algorithm>
+
+/*
+Instruction set used for the batched kernel evaluation, picked once at runtime
+*/
+enum class KernelIsa
+{
+    Scalar,
+    SSE,
+    AVX2,
+    AVX512
+};
+
+/*
+Cubic spline kernel with support radius 4h
+https://de.wikipedia.org/wiki/Smoothed_Particle_Hydrodynamics#Kern
+With h' = 2h and q = r / h'
+    0 <= q <= 1 : (4 - 6q^2 + 3q^3)
+    1 <  q <= 2 : (2 - q)^3
+    q > 2       : 0
+which is written branch-free as max(2 - q, 0)^3 - 4 max(1 - q, 0)^3.
+All divisions by h are done once in the constructor.
+*/
+class Kernel
+{
+public:
+    float h;
+    Kernel(float h = 1.0f);
+    float W(float r) const
+    {
+        float q = r * invH;
+        float outer = std::max(2 - q, 0.0f);
+        float inner = std::max(1 - q, 0.0f);
+        return wScale * (outer * outer * outer - 4 * inner * inner * inner);
+    }
+    float dW(float r) const
+    {
+        float q = r * invH;
+        float outer = std::max(2 - q, 0.0f);
+        float inner = std::max(1 - q, 0.0f);
+        return dWScale * (12 * inner * inner - 3 * outer * outer);
+    }
+    /*
+    Sum of W over n distances, and dW of every distance into gradients unless it is null.
+    Uses the widest vector instructions the cpu supports, the summation order (and so
+    the last bits of the result) depends on the instruction set but not on the thread count.
+    */
+    float sumWAndGradients(const float *r, float *gradients, int n) const;
+    float sumW(const float *r, int n) const { return sumWAndGradients(r, nullptr, n); }
+    void gradients(const float *r, float *gradients, int n) const { sumWAndGradients(r, gradients, n); }
+    static KernelIsa isa();
+    static const char *isaName();
+    // force an instruction set, clamped to what the cpu supports
+    static void setIsa(KernelIsa isa);
+
+private:
+    float invH;
+    float wScale;
+    float dWScale;
+};
\ No newline at end of file
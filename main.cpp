@@ -13,6 +13,10 @@ using namespace glm;
 #include "loadShader.h"
 #include "shapes.h"
 #include "fluid.h"
+#include "fluidRenderer.h"
+#include "simulationThread.h"
+#include "profiler.h"
+#include "profilerPanel.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/random.hpp>
@@ -68,7 +72,8 @@ int main()
     ImGui_ImplOpenGL3_Init();
 
     GLuint simpleShaderID = LoadShaders("shaders/localPosition");
-    GLuint instancingShaderID = LoadShaders("shaders/instancing");
+    GLuint particleShaderID = LoadShaders("shaders/particles");
+    GLuint impostorShaderID = LoadShaders("shaders/impostor");
 
     float dt = 0.0f;
     float t = 0.0f;
@@ -78,7 +83,19 @@ int main()
     double fpsLastTime = glfwGetTime();
     int frameCount = 0;
 
-    Fluid fluid(instancingShaderID);
+    FluidParameters parameters;
+    parameters.adaptiveTimeStep = true;
+    parameters.diagnosticsInterval = 30;
+    Fluid fluid(parameters);
+    // simulated seconds per wall clock second
+    float simulationSpeed = 1.0f;
+    bool unlimitedSpeed = false;
+    bool paused = false;
+    bool interpolate = true;
+    Profiler::global.setThreadName("render");
+    FluidRenderer fluidRenderer(particleShaderID, impostorShaderID, fluid.particleCount());
+    // from here on only the simulation thread touches fluid
+    SimulationThread simulation(fluid, simulationSpeed);
 
     glEnable(GL_CULL_FACE);
     glCullFace(GL_BACK);
@@ -109,6 +126,27 @@ int main()
         ImGui::NewFrame();
         ImGui::Begin("Test");
         ImGui::SliderFloat("float", &rotateSpeed, -80, 80);
+        ImGui::SliderFloat("simulation speed", &simulationSpeed, 0.1f, 5);
+        ImGui::Checkbox("as fast as possible", &unlimitedSpeed);
+        ImGui::Checkbox("pause", &paused);
+        ImGui::Checkbox("interpolate", &interpolate);
+        int colorMode = (int)fluidRenderer.colorMode;
+        ImGui::Combo("color", &colorMode, "density\0speed\0");
+        fluidRenderer.colorMode = (ColorMode)colorMode;
+        ImGui::Checkbox("impostors", &fluidRenderer.impostors);
+        simulation.setSpeed(unlimitedSpeed ? 0 : simulationSpeed);
+        simulation.setPaused(paused);
+        simulation.acquire();
+        ImGui::Text("dt %.4f, t %.2f, %.0f steps/s", simulation.current().dt, simulation.current().time, simulation.stepsPerSecond());
+        if (simulation.current().hasDiagnostics)
+        {
+            const Diagnostics &diagnostics = simulation.current().diagnostics;
+            ImGui::Text("energy %.4f (kinetic %.4f), max speed %.3f", diagnostics.totalEnergy(), diagnostics.kineticEnergy, diagnostics.maxSpeed);
+            ImGui::Text("density error %.2f%% mean, %.2f%% max", 100 * diagnostics.meanDensityError, 100 * diagnostics.maxDensityError);
+            if (diagnostics.sleepingParticles > 0)
+                ImGui::Text("sleeping %d of %d particles", diagnostics.sleepingParticles, diagnostics.particles);
+        }
+        drawProfilerPanel(Profiler::global);
         ImGui::End();
 
         deltaCursor = cursorPos - prevCursorPos;
@@ -137,18 +175,27 @@ int main()
             r * sin(radians(theta)),
             r * cos(radians(theta)) * cos(radians(phi)));
 
-        fluid.step();
-        fluid.draw();
+        if (interpolate)
+            fluidRenderer.draw(simulation.previous(), simulation.current(), simulation.interpolation());
+        else
+            fluidRenderer.draw(simulation.current());
 
         // Rendering
         // (Your code clears your framebuffer, renders your other stuff etc.)
-        ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            SPH_PROFILE_SCOPE("imgui");
+            ImGui::Render();
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
         // (Your code calls glfwSwapBuffers() etc.)
 
         // Swap buffers
-        glfwSwapBuffers(window);
+        {
+            SPH_PROFILE_SCOPE("swap buffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
+        Profiler::global.endFrame();
         double currentFrame = glfwGetTime();
         dt = (float)(currentFrame - lastFrame);
         t += dt;
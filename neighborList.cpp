@@ -0,0 +1,135 @@
+#include "neighborList.h"
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+using namespace glm;
+
+NeighborList::NeighborList(float cutoff, float skin) : cutoff(cutoff), skin(skin), builds(0)
+{
+}
+
+bool NeighborList::needsRebuild(int particleCount, float maxDisplacementSquared) const
+{
+    return builds == 0 || particleCount != (int)x0.size() || maxDisplacementSquared > 0.25f * skin * skin;
+}
+
+float NeighborList::maxDisplacementSquared(const Particles &particles, ThreadPool &pool)
+{
+    int n = particles.size();
+    if (n != (int)x0.size())
+        return 0;
+    threadMax.assign(pool.size(), 0);
+    pool.parallelFor(0, n, [&](int begin, int end, int thread)
+                     {
+        float maxSquared = 0;
+        for (int i = begin; i < end; i++)
+            maxSquared = std::max(maxSquared, displacementSquared(i, particles.x[i], particles.y[i], particles.z[i]));
+        threadMax[thread] = maxSquared; });
+    return *std::max_element(threadMax.begin(), threadMax.end());
+}
+
+void NeighborList::build(const Grid &grid, const Particles &particles, ThreadPool &pool)
+{
+    int n = particles.size();
+    float radius = cutoff + skin;
+    float radiusSquared = radius * radius;
+    rowStart.assign(n + 1, 0);
+
+    // count, prefix sum, fill: no per thread buffers and the result does not depend on the thread count
+    pool.parallelForDynamic(grid.taskCount(), [&](int task, int)
+                            {
+        for (int k = grid.taskBegin(task); k < grid.taskEnd(task); k++)
+        {
+            int i = grid.particleAt(k);
+            vec3 position = particles.position(i);
+            int count = 0;
+            grid.forEachNeighbor(position, [&](int j)
+                                 {
+                vec3 delta = position - particles.position(j);
+                if (j != i && dot(delta, delta) < radiusSquared)
+                    count++; });
+            rowStart[i + 1] = count;
+        } });
+    for (int i = 0; i < n; i++)
+        rowStart[i + 1] += rowStart[i];
+
+    neighbors.resize(rowStart[n]);
+    pool.parallelForDynamic(grid.taskCount(), [&](int task, int)
+                            {
+        for (int k = grid.taskBegin(task); k < grid.taskEnd(task); k++)
+        {
+            int i = grid.particleAt(k);
+            vec3 position = particles.position(i);
+            int next = rowStart[i];
+            grid.forEachNeighbor(position, [&](int j)
+                                 {
+                vec3 delta = position - particles.position(j);
+                if (j != i && dot(delta, delta) < radiusSquared)
+                    neighbors[next++] = j; });
+            // grid order is arbitrary, sorted rows touch memory in order
+            std::sort(neighbors.begin() + rowStart[i], neighbors.begin() + next);
+        } });
+
+    pairDistance.resize(neighbors.size());
+    pairDirX.resize(neighbors.size());
+    pairDirY.resize(neighbors.size());
+    pairDirZ.resize(neighbors.size());
+    pairGradient.resize(neighbors.size());
+    x0.assign(particles.x.data(), particles.x.data() + n);
+    y0.assign(particles.y.data(), particles.y.data() + n);
+    z0.assign(particles.z.data(), particles.z.data() + n);
+    builds++;
+}
+
+/*
+Direction to push apart two coinciding particles, pseudo random but only
+depending on the ids of the pair so results do not depend on the thread count or the particle order.
+Antisymmetric: the direction for (j, i) is the negative of (i, j).
+*/
+static vec3 coincidentDirection(int i, int j)
+{
+    uint32_t a = (uint32_t)std::min(i, j);
+    uint32_t b = (uint32_t)std::max(i, j);
+    uint32_t h = a * 0x9E3779B1u ^ (b + 0x7F4A7C15u) * 0x85EBCA77u;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    float u = (h & 0xFFFF) / 65535.0f;
+    float v = (h >> 16) / 65535.0f;
+    float z = 2 * u - 1;
+    float s = std::sqrt(std::max(0.0f, 1 - z * z));
+    float phi = 6.2831853f * v;
+    vec3 direction(s * std::cos(phi), s * std::sin(phi), z);
+    return i < j ? direction : -direction;
+}
+
+void NeighborList::updateRow(int i, const Particles &particles)
+{
+    float xi = particles.x[i];
+    float yi = particles.y[i];
+    float zi = particles.z[i];
+    for (int k = rowStart[i]; k < rowStart[i + 1]; k++)
+    {
+        int j = neighbors[k];
+        float dx = xi - particles.x[j];
+        float dy = yi - particles.y[j];
+        float dz = zi - particles.z[j];
+        float r = std::sqrt(dx * dx + dy * dy + dz * dz);
+        pairDistance[k] = r;
+        if (r < 1e-5)
+        {
+            // coinciding particles, push them apart in an arbitrary direction
+            vec3 direction = coincidentDirection(particles.id[i], particles.id[j]);
+            pairDirX[k] = direction.x;
+            pairDirY[k] = direction.y;
+            pairDirZ[k] = direction.z;
+        }
+        else
+        {
+            pairDirX[k] = dx / r;
+            pairDirY[k] = dy / r;
+            pairDirZ[k] = dz / r;
+        }
+    }
+}
\ No newline at end of file
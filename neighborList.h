@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+
+#include "grid.h"
+#include "particles.h"
+#include "threadPool.h"
+
+/*
+Verlet neighbor list in compressed row form.
+Row i holds every j != i that was closer than cutoff + skin when the list was built,
+so the list stays complete until some particle has moved further than skin / 2.
+Rows are full (both i -> j and j -> i are stored) so every pass can gather into
+particle i without writing to its neighbors.
+*/
+class NeighborList
+{
+public:
+    float cutoff;
+    float skin;
+    // number of rebuilds so far
+    int builds;
+    NeighborList(float cutoff, float skin);
+    /*
+    True if the list is empty, the particle count changed or a particle moved more than skin / 2 since the last build.
+    The solver finds the largest displacement in its own passes, maxDisplacementSquared scans for it.
+    */
+    bool needsRebuild(int particleCount, float maxDisplacementSquared) const;
+    float maxDisplacementSquared(const Particles &particles, ThreadPool &pool);
+    float displacementSquared(int i, float x, float y, float z) const
+    {
+        float dx = x - x0[i];
+        float dy = y - y0[i];
+        float dz = z - z0[i];
+        return dx * dx + dy * dy + dz * dz;
+    }
+    /*
+    Rebuild from a freshly updated grid whose cells are at least cutoff + skin wide
+    */
+    void build(const Grid &grid, const Particles &particles, ThreadPool &pool);
+    /*
+    Recompute the cached distance and direction of every pair of row i from the current positions
+    */
+    void updateRow(int i, const Particles &particles);
+    int begin(int i) const { return rowStart[i]; }
+    int end(int i) const { return rowStart[i + 1]; }
+    int pairCount() const { return (int)neighbors.size(); }
+    // row i is neighbors[rowStart[i]] to neighbors[rowStart[i + 1] - 1]
+    std::vector<int> rowStart;
+    std::vector<int> neighbors;
+    // per pair cache, |pos_i - pos_j| and the unit vector from j to i
+    std::vector<float> pairDistance;
+    std::vector<float> pairDirX;
+    std::vector<float> pairDirY;
+    std::vector<float> pairDirZ;
+    // dW of pairDistance, filled by the density pass for the force pass
+    std::vector<float> pairGradient;
+
+private:
+    friend class Checkpoint;
+    // positions at the last build
+    std::vector<float> x0;
+    std::vector<float> y0;
+    std::vector<float> z0;
+    std::vector<float> threadMax;
+};
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include <GL/glew.h>
+
+#include "offscreenContext.h"
+
+#include <EGL/eglext.h>
+#include <iostream>
+
+using namespace std;
+
+OffscreenContext::~OffscreenContext()
+{
+    if (context != EGL_NO_CONTEXT)
+    {
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+    }
+    if (display != EGL_NO_DISPLAY)
+        eglTerminate(display);
+}
+
+bool OffscreenContext::create(int major, int minor)
+{
+    // the surfaceless platform needs no X, Wayland or DRM device, fall back to the default display
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+    {
+        cerr << "Failed to initialize EGL" << endl;
+        display = EGL_NO_DISPLAY;
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        cerr << "EGL has no desktop OpenGL" << endl;
+        return false;
+    }
+
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE};
+    EGLConfig config;
+    EGLint configCount = 0;
+    // surfaceless contexts don't need a config, but not every driver supports EGL_KHR_no_config_context
+    if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+        config = (EGLConfig)0;
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, major,
+        EGL_CONTEXT_MINOR_VERSION, minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE};
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+    if (context == EGL_NO_CONTEXT)
+    {
+        cerr << "Failed to create an OpenGL " << major << "." << minor << " core context" << endl;
+        return false;
+    }
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    {
+        cerr << "Failed to make the context current" << endl;
+        return false;
+    }
+
+    glewExperimental = true;
+    GLenum result = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // GLEW built for GLX still loads the GL functions, it only misses the GLX extensions
+    if (result == GLEW_ERROR_NO_GLX_DISPLAY)
+        result = GLEW_OK;
+#endif
+    if (result != GLEW_OK)
+    {
+        cerr << "Failed to initialize GLEW: " << glewGetErrorString(result) << endl;
+        return false;
+    }
+    return true;
+}
+
+const char *OffscreenContext::renderer() const
+{
+    return (const char *)glGetString(GL_RENDERER);
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+#include <EGL/egl.h>
+
+/*
+OpenGL core context without any window or display server, through EGL's surfaceless
+platform. Works on GPU drivers and on Mesa's software rasterizer (llvmpipe),
+so frames can be rendered on CPU-only machines. Render into a framebuffer object.
+*/
+class OffscreenContext
+{
+public:
+    OffscreenContext() = default;
+    ~OffscreenContext();
+    OffscreenContext(const OffscreenContext &) = delete;
+    OffscreenContext &operator=(const OffscreenContext &) = delete;
+    /*
+    Create the context, make it current on the calling thread and load the GL functions.
+    4.5 is what Mesa's software rasterizer offers and all the renderers need.
+    Prints the reason and returns false on failure.
+    */
+    bool create(int major = 4, int minor = 5);
+    // GL_RENDERER of the created context
+    const char *renderer() const;
+
+private:
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+};
\ No newline at end of file
@@ -0,0 +1,33 @@
+#include "particles.h"
+
+using namespace glm;
+
+void Particles::resize(int n)
+{
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    vx.resize(n);
+    vy.resize(n);
+    vz.resize(n);
+    ax.resize(n);
+    ay.resize(n);
+    az.resize(n);
+    density.resize(n);
+    pressure.resize(n);
+    id.resize(n);
+}
+
+void Particles::setPosition(int i, vec3 p)
+{
+    x[i] = p.x;
+    y[i] = p.y;
+    z[i] = p.z;
+}
+
+void Particles::setVelocity(int i, vec3 v)
+{
+    vx[i] = v.x;
+    vy[i] = v.y;
+    vz[i] = v.z;
+}
\ No newline at end of file
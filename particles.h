@@ -0,0 +1,144 @@
+#pragma once
+#include <stddef.h>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include <glm/glm.hpp>
+
+// alignment of every particle array in bytes, one cache line / one AVX-512 register
+constexpr size_t particleAlignment = 64;
+// arrays are padded to a multiple of this many elements so vector loops need no scalar tail
+constexpr int particlePadding = particleAlignment / sizeof(float);
+
+/*
+Fixed size array with aligned storage, padded up to particlePadding elements.
+Padding elements are zero and are never touched by the solver.
+*/
+template <typename T>
+class AlignedArray
+{
+public:
+    AlignedArray() : values(nullptr), count(0), capacity(0) {}
+    AlignedArray(const AlignedArray &other) : AlignedArray() { *this = other; }
+    AlignedArray &operator=(const AlignedArray &other);
+    void resize(int n);
+    /*
+    Use memory owned by someone else, e.g. a mapped checkpoint, instead of allocating.
+    values must be particleAlignment aligned and hold capacity >= n elements,
+    storage keeps it alive for as long as this array or a later copy of the pointer needs it.
+    */
+    void adopt(T *values, int n, int capacity, std::shared_ptr<void> storage);
+    void fill(T value);
+    // exchange the contents with other without copying
+    void swap(AlignedArray &other);
+    int size() const { return count; }
+    int paddedSize() const { return capacity; }
+    T *data() { return values; }
+    const T *data() const { return values; }
+    T &operator[](int i) { return values[i]; }
+    const T &operator[](int i) const { return values[i]; }
+
+private:
+    T *values;
+    int count;
+    int capacity;
+    std::shared_ptr<void> storage;
+};
+
+// one particle outside of the arrays, e.g. on its way to another process
+struct ParticleRecord
+{
+    int id;
+    float x, y, z;
+    float vx, vy, vz;
+};
+
+/*
+Structure-of-arrays particle storage.
+Physics passes read and write the component arrays directly, render-side
+Transforms are only produced when a frame is drawn.
+*/
+class Particles
+{
+public:
+    AlignedArray<float> x, y, z;
+    AlignedArray<float> vx, vy, vz;
+    AlignedArray<float> ax, ay, az;
+    AlignedArray<float> density;
+    AlignedArray<float> pressure;
+    /*
+    Index the particle was created with. The solver reorders the particles into grid order
+    whenever it rebuilds the neighbor list, anything that follows particles over time goes by id.
+    */
+    AlignedArray<int> id;
+    void resize(int n);
+    int size() const { return x.size(); }
+    int paddedSize() const { return x.paddedSize(); }
+    glm::vec3 position(int i) const { return glm::vec3(x[i], y[i], z[i]); }
+    glm::vec3 velocity(int i) const { return glm::vec3(vx[i], vy[i], vz[i]); }
+    void setPosition(int i, glm::vec3 p);
+    void setVelocity(int i, glm::vec3 v);
+};
+
+template <typename T>
+AlignedArray<T> &AlignedArray<T>::operator=(const AlignedArray &other)
+{
+    if (this == &other)
+        return *this;
+    resize(other.count);
+    for (int i = 0; i < other.count; i++)
+        values[i] = other.values[i];
+    return *this;
+}
+
+template <typename T>
+void AlignedArray<T>::resize(int n)
+{
+    int padded = (n + particlePadding - 1) / particlePadding * particlePadding;
+    if (padded != capacity)
+    {
+        T *next = static_cast<T *>(::operator new[](padded * sizeof(T), std::align_val_t(particleAlignment)));
+        std::shared_ptr<void> nextStorage(next, [](void *p)
+                                          { ::operator delete[](p, std::align_val_t(particleAlignment)); });
+        int kept = n < count ? n : count;
+        for (int i = 0; i < kept; i++)
+            next[i] = values[i];
+        for (int i = kept; i < padded; i++)
+            next[i] = T();
+        values = next;
+        storage = nextStorage;
+        capacity = padded;
+    }
+    else
+    {
+        for (int i = n; i < count; i++)
+            values[i] = T();
+    }
+    count = n;
+}
+
+template <typename T>
+void AlignedArray<T>::adopt(T *values, int n, int capacity, std::shared_ptr<void> storage)
+{
+    this->values = values;
+    this->count = n;
+    this->capacity = capacity;
+    this->storage = std::move(storage);
+}
+
+template <typename T>
+void AlignedArray<T>::swap(AlignedArray &other)
+{
+    std::swap(values, other.values);
+    std::swap(count, other.count);
+    std::swap(capacity, other.capacity);
+    storage.swap(other.storage);
+}
+
+template <typename T>
+void AlignedArray<T>::fill(T value)
+{
+    for (int i = 0; i < count; i++)
+        values[i] = value;
+}
\ No newline at end of file
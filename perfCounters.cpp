@@ -0,0 +1,179 @@
+#include "perfCounters.h"
+
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+using namespace std;
+
+const char *PerfCounters::eventName(int event)
+{
+    static const char *names[eventCount] = {"cycles", "instructions", "L1d misses", "LLC misses", "branch misses", "dTLB misses"};
+    return names[event];
+}
+
+PerfCounters::PerfCounters() : leader(-1), groupSize(0), mask(0)
+{
+    for (int e = 0; e < eventCount; e++)
+    {
+        fds[e] = -1;
+        groupIndex[e] = -1;
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    close();
+}
+
+#ifdef __linux__
+static uint64_t cacheEvent(uint64_t cache, uint64_t operation, uint64_t result)
+{
+    return cache | operation << 8 | result << 16;
+}
+
+static int openEvent(uint32_t type, uint64_t config, int groupFd)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    // only a leader starts disabled, members follow it
+    attr.disabled = groupFd == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    if (groupFd == -1)
+        attr.read_format |= PERF_FORMAT_GROUP;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+bool PerfCounters::open(string &error)
+{
+    close();
+    struct
+    {
+        uint32_t type;
+        uint64_t config;
+    } events[eventCount] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)}};
+
+    int firstError = 0;
+    for (int e = 0; e < eventCount; e++)
+    {
+        // join the group so the ratios are taken over the same time, alone if the pmu can't fit it
+        int fd = leader != -1 ? openEvent(events[e].type, events[e].config, leader) : -1;
+        if (fd != -1)
+            groupIndex[e] = groupSize++;
+        else
+        {
+            fd = openEvent(events[e].type, events[e].config, -1);
+            if (fd == -1)
+            {
+                if (!firstError)
+                    firstError = errno;
+                continue;
+            }
+            if (leader == -1)
+            {
+                leader = fd;
+                groupIndex[e] = groupSize++;
+            }
+        }
+        fds[e] = fd;
+        mask |= 1u << e;
+    }
+    if (!mask)
+    {
+        error = string("perf_event_open: ") + strerror(firstError);
+        if (firstError == EACCES || firstError == EPERM)
+            error += ", check /proc/sys/kernel/perf_event_paranoid";
+        else if (firstError == ENOENT || firstError == EOPNOTSUPP)
+            error += ", no hardware counters (virtual machine?)";
+        return false;
+    }
+    for (int e = 0; e < eventCount; e++)
+    {
+        // the leader enables its members, every other event is a leader of its own
+        if (fds[e] != -1 && (fds[e] == leader || groupIndex[e] == -1))
+        {
+            ioctl(fds[e], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[e], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    return true;
+}
+
+void PerfCounters::close()
+{
+    for (int e = 0; e < eventCount; e++)
+    {
+        if (fds[e] != -1)
+            ::close(fds[e]);
+        fds[e] = -1;
+        groupIndex[e] = -1;
+    }
+    leader = -1;
+    groupSize = 0;
+    mask = 0;
+}
+
+// counts of a group read, scaled up for the time the counters weren't scheduled
+static bool readGroup(int fd, uint64_t *values, int count)
+{
+    uint64_t buffer[3 + PerfCounters::eventCount];
+    ssize_t size = (ssize_t)((3 + count) * sizeof(uint64_t));
+    if (::read(fd, buffer, size) != size)
+        return false;
+    uint64_t enabled = buffer[1];
+    uint64_t running = buffer[2];
+    for (int i = 0; i < count; i++)
+        values[i] = running > 0 && running < enabled ? (uint64_t)((double)buffer[3 + i] * enabled / running) : buffer[3 + i];
+    return true;
+}
+
+void PerfCounters::read(uint64_t values[eventCount]) const
+{
+    uint64_t group[eventCount] = {};
+    if (leader != -1)
+        readGroup(leader, group, groupSize);
+    for (int e = 0; e < eventCount; e++)
+    {
+        values[e] = 0;
+        if (fds[e] == -1)
+            continue;
+        if (groupIndex[e] != -1)
+            values[e] = group[groupIndex[e]];
+        else
+            readGroup(fds[e], &values[e], 1);
+    }
+}
+#else
+bool PerfCounters::open(string &error)
+{
+    error = "hardware counters need Linux perf_event_open";
+    return false;
+}
+
+void PerfCounters::close()
+{
+}
+
+void PerfCounters::read(uint64_t values[eventCount]) const
+{
+    for (int e = 0; e < eventCount; e++)
+        values[e] = 0;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+
+/*
+Hardware counters of the calling thread through Linux perf_event_open, user space only.
+Counting works without privileges as long as /proc/sys/kernel/perf_event_paranoid <= 2.
+Events the cpu or the hypervisor doesn't offer are left out, on other platforms open always fails.
+*/
+class PerfCounters
+{
+public:
+    enum Event
+    {
+        Cycles,
+        Instructions,
+        L1Misses,
+        LlcMisses,
+        BranchMisses,
+        DtlbMisses,
+        eventCount
+    };
+    static const char *eventName(int event);
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+    /*
+    Start counting on the calling thread, the events share one group where the pmu allows.
+    Returns false with the reason in error if no event could be opened.
+    */
+    bool open(std::string &error);
+    void close();
+    bool isOpen() const { return mask != 0; }
+    // bit e is set if event e is counted
+    unsigned availableMask() const { return mask; }
+    /*
+    Counts since open, scaled by enabled / running time when the kernel had to multiplex
+    the counters. Events that aren't available read 0.
+    */
+    void read(uint64_t values[eventCount]) const;
+
+private:
+    int fds[eventCount];
+    // group leader, -1 if every event is on its own
+    int leader;
+    // position of every event in the group read, -1 if it is read on its own
+    int groupIndex[eventCount];
+    int groupSize;
+    unsigned mask;
+};
+
+// sums of the counters of one phase
+struct PerfCounts
+{
+    uint64_t values[PerfCounters::eventCount] = {};
+    void add(const uint64_t other[PerfCounters::eventCount])
+    {
+        for (int e = 0; e < PerfCounters::eventCount; e++)
+            values[e] += other[e];
+    }
+};
\ No newline at end of file
@@ -0,0 +1,240 @@
+#include "profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+Profiler Profiler::global;
+#if SPH_PROFILE
+thread_local int ProfileScope::depth = 0;
+thread_local const char *ProfileScope::current = nullptr;
+#endif
+
+Profiler::Profiler() : position(0), frames(0), tracing(false), counting(false), mask(0), maxTraceEvents(0)
+{
+}
+
+uint64_t Profiler::now()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Profiler::ThreadLog &Profiler::threadLog()
+{
+    // registered on first use, the log outlives its thread so no event is lost
+    thread_local ThreadLog *log = nullptr;
+    if (!log)
+    {
+        lock_guard<std::mutex> lock(mutex);
+        logs.push_back(make_unique<ThreadLog>());
+        log = logs.back().get();
+        log->thread = (int)logs.size() - 1;
+        log->name = "thread " + to_string(log->thread);
+        log->written = 0;
+        log->read = 0;
+    }
+    return *log;
+}
+
+void Profiler::record(const char *name, uint64_t start, uint64_t end, int depth, const uint64_t *counters, bool worker)
+{
+    ThreadLog &log = threadLog();
+    uint64_t index = log.written.load(memory_order_relaxed);
+    ProfileEvent &event = log.events[index % ringSize];
+    event = {name, start, end - start, log.thread, depth, worker, counters != nullptr, {}};
+    if (counters)
+        memcpy(event.counters, counters, sizeof(event.counters));
+    log.written.store(index + 1, memory_order_release);
+}
+
+void Profiler::setThreadName(const char *name)
+{
+    ThreadLog &log = threadLog();
+    lock_guard<std::mutex> lock(mutex);
+    log.name = name;
+}
+
+string Profiler::threadName(int thread)
+{
+    lock_guard<std::mutex> lock(mutex);
+    return thread >= 0 && thread < (int)logs.size() ? logs[thread]->name : string();
+}
+
+// opened once per thread and closed when the thread exits, unlike the thread logs
+static PerfCounters *threadCounters(string *error = nullptr)
+{
+    thread_local PerfCounters counters;
+    thread_local bool opened = false;
+    thread_local string openError;
+    if (!opened)
+    {
+        counters.open(openError);
+        opened = true;
+    }
+    if (error)
+        *error = openError;
+    return counters.isOpen() ? &counters : nullptr;
+}
+
+bool Profiler::enableCounters()
+{
+    string error;
+    PerfCounters *counters = threadCounters(&error);
+    if (!counters)
+    {
+        cerr << "hardware counters unavailable: " << error << endl;
+        return false;
+    }
+    mask = counters->availableMask();
+    counting = true;
+    return true;
+}
+
+bool Profiler::readCounters(uint64_t values[PerfCounters::eventCount])
+{
+    PerfCounters *counters = threadCounters();
+    if (!counters)
+        return false;
+    counters->read(values);
+    return true;
+}
+
+void Profiler::endFrame()
+{
+    for (Phase &phase : phases)
+        phase.frameTotal = 0;
+    size_t known = phases.size();
+    vector<ThreadLog *> current;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        for (const unique_ptr<ThreadLog> &log : logs)
+            current.push_back(log.get());
+    }
+    for (ThreadLog *entry : current)
+    {
+        ThreadLog &log = *entry;
+        uint64_t written = log.written.load(memory_order_acquire);
+        // a ring that was lapped lost its oldest events
+        uint64_t begin = max(log.read, written > ringSize ? written - ringSize : 0);
+        for (uint64_t i = begin; i < written; i++)
+        {
+            ProfileEvent event = log.events[i % ringSize];
+            // the slot may have been overwritten while it was copied
+            if (log.written.load(memory_order_acquire) - i > ringSize)
+                continue;
+            size_t phase = 0;
+            while (phase < phases.size() && phases[phase].name != event.name && strcmp(phases[phase].name, event.name) != 0)
+                phase++;
+            if (phase == phases.size())
+                phases.push_back({event.name, event.depth, {}, 0, 0, event.start, 0, false, {}, {}});
+            phases[phase].firstStart = min(phases[phase].firstStart, event.start);
+            if (!event.worker)
+                phases[phase].frameTotal += event.duration * 1e-6f;
+            if (event.counted)
+            {
+                Phase &counted = phases[phase];
+                counted.counted = true;
+                counted.counts.add(event.counters);
+                if ((int)counted.threadCounts.size() <= event.thread)
+                    counted.threadCounts.resize(event.thread + 1);
+                counted.threadCounts[event.thread].add(event.counters);
+            }
+            if (tracing && (int)trace.size() < maxTraceEvents)
+                trace.push_back(event);
+        }
+        log.read = written;
+    }
+
+    if (phases.size() > known)
+    {
+        stable_sort(phases.begin(), phases.end(), [](const Phase &a, const Phase &b)
+                    { return a.firstStart < b.firstStart; });
+    }
+
+    position = (position + 1) % historyLength;
+    frames++;
+    for (Phase &phase : phases)
+    {
+        phase.history[position] = phase.frameTotal;
+        phase.total += phase.frameTotal;
+        float sum = 0;
+        for (float value : phase.history)
+            sum += value;
+        phase.average = sum / historyLength;
+    }
+}
+
+void Profiler::reset()
+{
+    lock_guard<std::mutex> lock(mutex);
+    for (const unique_ptr<ThreadLog> &log : logs)
+        log->read = log->written.load(memory_order_acquire);
+    phases.clear();
+    position = 0;
+    frames = 0;
+    trace.clear();
+}
+
+void Profiler::startTrace(int maxEvents)
+{
+    trace.clear();
+    maxTraceEvents = maxEvents;
+    tracing = true;
+}
+
+bool Profiler::stopTrace(const string &path)
+{
+    endFrame();
+    tracing = false;
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file)
+    {
+        cerr << "Can't open " << path << endl;
+        return false;
+    }
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    const char *separator = "\n";
+    {
+        lock_guard<std::mutex> lock(mutex);
+        for (const unique_ptr<ThreadLog> &log : logs)
+        {
+            fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}", separator, log->thread, log->name.c_str());
+            separator = ",\n";
+        }
+    }
+    uint64_t origin = trace.empty() ? 0 : trace[0].start;
+    for (const ProfileEvent &event : trace)
+        origin = min(origin, event.start);
+    for (const ProfileEvent &event : trace)
+    {
+        // complete events, microseconds since the first event
+        fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                separator, event.name, event.thread, (event.start - origin) * 1e-3, event.duration * 1e-3);
+        if (event.counted)
+        {
+            const char *argument = "";
+            fprintf(file, ", \"args\": {");
+            for (int e = 0; e < PerfCounters::eventCount; e++)
+            {
+                if (mask & 1u << e)
+                {
+                    fprintf(file, "%s\"%s\": %llu", argument, PerfCounters::eventName(e), (unsigned long long)event.counters[e]);
+                    argument = ", ";
+                }
+            }
+            fprintf(file, "}");
+        }
+        fprintf(file, "}");
+        separator = ",\n";
+    }
+    fprintf(file, "\n]}\n");
+    bool ok = !ferror(file);
+    fclose(file);
+    trace.clear();
+    trace.shrink_to_fit();
+    return ok;
+}
\ No newline at end of file
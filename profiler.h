@@ -0,0 +1,172 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "perfCounters.h"
+
+// scoped timers are compiled in unless SPH_PROFILE is defined to 0
+#ifndef SPH_PROFILE
+#define SPH_PROFILE 1
+#endif
+
+struct ProfileEvent
+{
+    // string literal, events with the same name are summed into one phase
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+    int thread;
+    int depth;
+    // share of another thread's phase, e.g. a thread pool job, counted but not added to the phase time
+    bool worker;
+    bool counted;
+    uint64_t counters[PerfCounters::eventCount];
+};
+
+/*
+Collects timed scopes from every thread. Every thread writes its events into its own
+ring without locks; endFrame, called once per frame by one thread, drains all rings and
+adds the time of every phase to its history. Events are also kept while a trace is running.
+*/
+class Profiler
+{
+public:
+    static constexpr int historyLength = 240;
+    static Profiler global;
+    struct Phase
+    {
+        const char *name;
+        // nesting depth of the first event, for indenting
+        int depth;
+        // milliseconds per frame, summed over all threads, a ring ending at historyPosition
+        float history[historyLength];
+        float average;
+        // milliseconds over all frames so far
+        double total;
+        // phases are listed in order of their first start, which puts children after their parent
+        uint64_t firstStart;
+        float frameTotal;
+        /*
+        Hardware counters over all frames so far, summed over all threads and per thread.
+        Like the time they include the children on the thread that opened the scope,
+        thread pool workers only count into the innermost phase.
+        */
+        bool counted;
+        PerfCounts counts;
+        std::vector<PerfCounts> threadCounts;
+    };
+    Profiler();
+    // nanoseconds on a steady clock
+    static uint64_t now();
+    void record(const char *name, uint64_t start, uint64_t end, int depth, const uint64_t *counters = nullptr, bool worker = false);
+    // name of the calling thread in traces
+    void setThreadName(const char *name);
+    std::string threadName(int thread);
+    /*
+    Count hardware events in every scope from now on, thread pool jobs are counted as
+    a share of the phase that started them. Prints why and returns false if the calling
+    thread can't open any counter, everything else keeps working without them.
+    */
+    bool enableCounters();
+    bool countersEnabled() const { return counting.load(std::memory_order_relaxed); }
+    // events available on the thread that enabled the counters
+    unsigned counterMask() const { return mask; }
+    // counters of the calling thread, opened on first use, false if it has none
+    static bool readCounters(uint64_t values[PerfCounters::eventCount]);
+    void endFrame();
+    // drop everything recorded so far and start counting from zero
+    void reset();
+    // phases in order of first appearance, only valid on the thread that calls endFrame
+    const std::vector<Phase> &getPhases() const { return phases; }
+    // index of the newest history entry
+    int historyPosition() const { return position; }
+    int frameCount() const { return frames; }
+    void startTrace(int maxEvents = 1 << 20);
+    bool isTracing() const { return tracing; }
+    /*
+    Stop tracing and write the events as Chrome trace event JSON (chrome://tracing, Perfetto).
+    Prints the reason and returns false on failure.
+    */
+    bool stopTrace(const std::string &path);
+
+private:
+    static constexpr int ringSize = 1 << 14;
+    struct ThreadLog
+    {
+        int thread;
+        std::string name;
+        ProfileEvent events[ringSize];
+        // events written so far, only ever grows
+        std::atomic<uint64_t> written;
+        // events drained so far, owned by the frame thread
+        uint64_t read;
+    };
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadLog>> logs;
+    std::vector<Phase> phases;
+    int position;
+    int frames;
+    bool tracing;
+    std::atomic<bool> counting;
+    unsigned mask;
+    int maxTraceEvents;
+    std::vector<ProfileEvent> trace;
+    ThreadLog &threadLog();
+};
+
+#if SPH_PROFILE
+/*
+Times its own lifetime
+*/
+class ProfileScope
+{
+public:
+    ProfileScope(const char *name) : ProfileScope(name, depth, false) {}
+    // share of a phase of another thread at phaseDepth, only recorded while counting
+    ProfileScope(const char *name, int phaseDepth, bool worker) : name(name), parent(current), eventDepth(phaseDepth), worker(worker)
+    {
+        counted = Profiler::global.countersEnabled() && Profiler::readCounters(counters);
+        depth++;
+        current = name;
+        start = Profiler::now();
+    }
+    ~ProfileScope()
+    {
+        uint64_t end = Profiler::now();
+        depth--;
+        current = parent;
+        if (counted)
+        {
+            uint64_t now[PerfCounters::eventCount];
+            Profiler::readCounters(now);
+            for (int e = 0; e < PerfCounters::eventCount; e++)
+                counters[e] = now[e] - counters[e];
+        }
+        if (counted || !worker)
+            Profiler::global.record(name, start, end, eventDepth, counted ? counters : nullptr, worker);
+    }
+    // innermost scope of the calling thread and its depth, null outside of any scope
+    static const char *currentName() { return current; }
+    static int currentDepth() { return depth - 1; }
+
+private:
+    const char *name;
+    const char *parent;
+    uint64_t start;
+    int eventDepth;
+    bool worker;
+    bool counted;
+    uint64_t counters[PerfCounters::eventCount];
+    static thread_local int depth;
+    static thread_local const char *current;
+};
+#define SPH_PROFILE_CONCAT2(a, b) a##b
+#define SPH_PROFILE_CONCAT(a, b) SPH_PROFILE_CONCAT2(a, b)
+#define SPH_PROFILE_SCOPE(name) ProfileScope SPH_PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define SPH_PROFILE_SCOPE(name) ((void)0)
+#endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include "profilerPanel.h"
+
+#include <float.h>
+#include <stdio.h>
+
+#include "imgui.h"
+
+void drawProfilerPanel(Profiler &profiler, const char *tracePath)
+{
+    if (!ImGui::CollapsingHeader("Profiler"))
+        return;
+#if !SPH_PROFILE
+    ImGui::Text("built without SPH_PROFILE");
+#endif
+    if (!profiler.isTracing())
+    {
+        if (ImGui::Button("start trace"))
+            profiler.startTrace();
+    }
+    else if (ImGui::Button("stop trace"))
+        profiler.stopTrace(tracePath);
+    if (profiler.isTracing())
+    {
+        ImGui::SameLine();
+        ImGui::Text("recording to %s", tracePath);
+    }
+    // stays off once it failed, the reason went to stderr
+    static bool countersFailed = false;
+    if (!profiler.countersEnabled() && !countersFailed && ImGui::Button("count hardware events"))
+        countersFailed = !profiler.enableCounters();
+    if (countersFailed)
+        ImGui::Text("hardware counters unavailable");
+
+    // the history rings end at historyPosition, PlotLines starts at the oldest entry
+    int offset = (profiler.historyPosition() + 1) % Profiler::historyLength;
+    for (const Profiler::Phase &phase : profiler.getPhases())
+    {
+        char overlay[32];
+        snprintf(overlay, sizeof(overlay), "%.3f ms", phase.average);
+        ImGui::Indent(phase.depth * 10.0f + 1);
+        ImGui::PlotLines(phase.name, phase.history, Profiler::historyLength, offset, overlay, 0, FLT_MAX, ImVec2(200, 30));
+        if (phase.counted && ImGui::IsItemHovered())
+        {
+            // totals since counting started, summed over all threads
+            const uint64_t *values = phase.counts.values;
+            ImGui::BeginTooltip();
+            if (values[PerfCounters::Cycles])
+                ImGui::Text("IPC %.2f", (double)values[PerfCounters::Instructions] / values[PerfCounters::Cycles]);
+            for (int e = 0; e < PerfCounters::eventCount; e++)
+            {
+                if (!(profiler.counterMask() & 1u << e))
+                    continue;
+                if (e == PerfCounters::Cycles || e == PerfCounters::Instructions || !values[PerfCounters::Instructions])
+                    ImGui::Text("%s %llu", PerfCounters::eventName(e), (unsigned long long)values[e]);
+                else
+                    ImGui::Text("%s %llu (%.2f/kinst)", PerfCounters::eventName(e), (unsigned long long)values[e], 1000.0 * values[e] / values[PerfCounters::Instructions]);
+            }
+            ImGui::EndTooltip();
+        }
+        ImGui::Unindent(phase.depth * 10.0f + 1);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,8 @@
+#pragma once
+#include "profiler.h"
+
+/*
+Live breakdown of the profiler phases for the current ImGui window:
+the average of every phase, its history as a graph, and trace capture to a file
+*/
+void drawProfilerPanel(Profiler &profiler, const char *tracePath = "trace.json");
\ No newline at end of file
@@ -0,0 +1,207 @@
+#include <GL/glew.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "fluid.h"
+#include "snapshot.h"
+#include "RenderObject.h"
+#include "loadShader.h"
+#include "fluidRenderer.h"
+#include "offscreenContext.h"
+#include "frameCapture.h"
+#include "imageWriter.h"
+
+using namespace glm;
+using namespace std;
+
+static void printUsage(const char *program)
+{
+    cout << "usage: " << program << " [options]\n"
+         << "Renders the simulation offscreen into an image sequence, no display needed.\n"
+         << "  --particles N       total particle count, rounded to a cube (default 1000)\n"
+         << "  --block X Y Z       particle block dimensions instead of --particles\n"
+         << "  --frames N          number of frames (default 100)\n"
+         << "  --frame-time F      simulated seconds per frame (default 1/60)\n"
+         << "  --size W H          image size (default 1000 1000)\n"
+         << "  --format raw|ppm|png (default png)\n"
+         << "  --output PREFIX     files are PREFIX_00000.png, ... (default frames/frame)\n"
+         << "  --color density|speed\n"
+         << "  --meshes            icosphere meshes instead of ray cast impostors\n"
+         << "  --distance F        camera distance from the center (default 5)\n"
+         << "  --dt F              time step, upper bound with --adaptive\n"
+         << "  --adaptive          adaptive CFL time step\n"
+         << "  --threads N         solver threads (default: all hardware threads)\n"
+         << "--particles rounds to a cube and scales h, skin and mass with the spacing, later options override them.\n";
+}
+
+int main(int argc, char **argv)
+{
+    FluidParameters parameters;
+    int frames = 100;
+    double frameTime = 1.0 / 60;
+    int width = 1000;
+    int height = 1000;
+    float distance = 5;
+    ImageFormat format = ImageFormat::Png;
+    string output = "frames/frame";
+    ColorMode colorMode = ColorMode::Density;
+    bool impostors = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        // every option takes at least one value
+        auto value = [&](int offset = 1) -> const char *
+        {
+            if (i + offset >= argc)
+            {
+                cerr << "missing value for " << arg << endl;
+                exit(1);
+            }
+            return argv[i + offset];
+        };
+        if (arg == "--particles")
+            parameters.setParticleCount((int)atof(value())), i++;
+        else if (arg == "--block")
+        {
+            parameters.nx = atoi(value(1));
+            parameters.ny = atoi(value(2));
+            parameters.nz = atoi(value(3));
+            i += 3;
+        }
+        else if (arg == "--frames")
+            frames = atoi(value()), i++;
+        else if (arg == "--frame-time")
+            frameTime = atof(value()), i++;
+        else if (arg == "--size")
+        {
+            width = atoi(value(1));
+            height = atoi(value(2));
+            i += 2;
+        }
+        else if (arg == "--format")
+        {
+            string type = value();
+            if (type == "raw")
+                format = ImageFormat::Raw;
+            else if (type == "ppm")
+                format = ImageFormat::Ppm;
+            else if (type == "png")
+                format = ImageFormat::Png;
+            else
+            {
+                cerr << "unknown format " << type << endl;
+                return 1;
+            }
+            i++;
+        }
+        else if (arg == "--output")
+            output = value(), i++;
+        else if (arg == "--color")
+        {
+            string mode = value();
+            if (mode == "density")
+                colorMode = ColorMode::Density;
+            else if (mode == "speed")
+                colorMode = ColorMode::Speed;
+            else
+            {
+                cerr << "unknown color mode " << mode << endl;
+                return 1;
+            }
+            i++;
+        }
+        else if (arg == "--meshes")
+            impostors = false;
+        else if (arg == "--distance")
+            distance = (float)atof(value()), i++;
+        else if (arg == "--dt")
+            parameters.dt = (float)atof(value()), i++;
+        else if (arg == "--adaptive")
+            parameters.adaptiveTimeStep = true;
+        else if (arg == "--threads")
+            parameters.threads = atoi(value()), i++;
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            cerr << "unknown option " << arg << endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    OffscreenContext context;
+    if (!context.create())
+        return -1;
+    cout << "renderer: " << context.renderer() << endl;
+
+    GLuint particleShaderID = LoadShaders("shaders/particles");
+    GLuint impostorShaderID = LoadShaders("shaders/impostor");
+
+    Fluid fluid(parameters);
+    cout << "particles: " << fluid.particleCount() << endl;
+    FluidRenderer fluidRenderer(particleShaderID, impostorShaderID, fluid.particleCount());
+    fluidRenderer.colorMode = colorMode;
+    fluidRenderer.impostors = impostors;
+
+    Camera::mainCamera.width = width;
+    Camera::mainCamera.height = height;
+    Camera::mainCamera.position = vec3(0, 0, distance);
+    Camera::mainCamera.target = vec3(0, 0, 0);
+
+    FrameCapture capture(width, height);
+    if (!capture.isComplete())
+    {
+        cerr << "Framebuffer is incomplete" << endl;
+        return -1;
+    }
+    ImageWriter writer(output, format);
+
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+
+    auto start = chrono::steady_clock::now();
+    Snapshot snapshots[2];
+    snapshots[0].capture(fluid);
+    for (int frame = 0; frame < frames; frame++)
+    {
+        const Snapshot &drawn = snapshots[frame % 2];
+        Snapshot &next = snapshots[(frame + 1) % 2];
+        // the solver advances to the next frame while this one is drawn and read back
+        thread solver;
+        if (frame + 1 < frames)
+            solver = thread([&]
+                            {
+                fluid.advance(frameTime);
+                next.capture(fluid); });
+
+        capture.bind();
+        glClearColor(0.0f, 0.0f, 0.4f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        fluidRenderer.draw(drawn);
+        capture.capture(writer);
+
+        if (solver.joinable())
+            solver.join();
+    }
+    capture.flush(writer);
+    auto end = chrono::steady_clock::now();
+
+    double seconds = chrono::duration<double>(end - start).count();
+    cout << "frames: " << frames << endl;
+    cout << "simulated time: " << fluid.getTime() << " s" << endl;
+    cout << "time: " << seconds << " s" << endl;
+    cout << "frames/s: " << frames / seconds << endl;
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fluid.h"
+
+using namespace std;
+
+/*
+Strong and weak scaling of Fluid::step over thread counts.
+Strong scaling keeps the particle count, weak scaling keeps the particles per thread.
+Every point takes warmup steps, then samples of a fixed number of steps until the
+coefficient of variation of the sample times is below the target.
+*/
+
+enum class Scaling
+{
+    Strong,
+    Weak
+};
+
+struct ScalingOptions
+{
+    vector<int> threads;
+    // strong scaling particle count
+    int particles = 64000;
+    // weak scaling particles per thread
+    int particlesPerThread = 16000;
+    int warmup = 20;
+    // steps per sample
+    int steps = 20;
+    int minSamples = 3;
+    int maxSamples = 30;
+    // stop sampling once stddev / mean of the sample times is below this
+    float targetVariation = 0.02f;
+    GridType gridType = GridType::Dense;
+    int tableSize = 0;
+};
+
+struct ScalingPoint
+{
+    Scaling scaling;
+    int threads;
+    int particles;
+    int samples;
+    int steps;
+    // seconds per step
+    double mean;
+    double median;
+    double stddev;
+    double particlesPerSecond;
+    double speedup;
+    double efficiency;
+    int neighborListBuilds;
+};
+
+static const char *scalingName(Scaling scaling)
+{
+    return scaling == Scaling::Strong ? "strong" : "weak";
+}
+
+static ScalingPoint measure(Scaling scaling, int threads, int n, const ScalingOptions &options)
+{
+    FluidParameters parameters;
+    parameters.setParticleCount(n);
+    parameters.threads = threads;
+    parameters.gridType = options.gridType;
+    if (options.tableSize > 0)
+        parameters.tableSize = options.tableSize;
+    Fluid fluid(parameters);
+    for (int i = 0; i < options.warmup; i++)
+        fluid.step();
+
+    int builds = fluid.neighborListBuilds();
+    vector<double> samples;
+    double mean = 0;
+    double stddev = 0;
+    while ((int)samples.size() < options.maxSamples)
+    {
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < options.steps; i++)
+            fluid.step();
+        samples.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count() / options.steps);
+
+        int count = (int)samples.size();
+        mean = 0;
+        for (double s : samples)
+            mean += s / count;
+        double variance = 0;
+        for (double s : samples)
+            variance += (s - mean) * (s - mean) / max(count - 1, 1);
+        stddev = sqrt(variance);
+        if (count >= options.minSamples && stddev <= options.targetVariation * mean)
+            break;
+    }
+
+    ScalingPoint point;
+    point.scaling = scaling;
+    point.threads = fluid.threadCount();
+    point.particles = fluid.particleCount();
+    point.samples = (int)samples.size();
+    point.steps = point.samples * options.steps;
+    point.mean = mean;
+    point.stddev = stddev;
+    sort(samples.begin(), samples.end());
+    size_t half = samples.size() / 2;
+    point.median = samples.size() % 2 ? samples[half] : (samples[half - 1] + samples[half]) / 2;
+    point.particlesPerSecond = point.particles / point.median;
+    point.speedup = 1;
+    point.efficiency = 1;
+    point.neighborListBuilds = fluid.neighborListBuilds() - builds;
+    return point;
+}
+
+/*
+Relative to the first point of the sweep, usually one thread, from the particle throughput
+so the rounding of the particle counts to cubes cancels out.
+Strong scaling: speedup = T(p0) / T(p). Weak scaling: the scaled speedup, the throughput ratio.
+Both: efficiency = speedup * p0 / p.
+*/
+static void computeEfficiency(vector<ScalingPoint> &points)
+{
+    const ScalingPoint &base = points[0];
+    for (ScalingPoint &point : points)
+    {
+        point.speedup = point.particlesPerSecond / base.particlesPerSecond;
+        point.efficiency = point.speedup * base.threads / point.threads;
+    }
+}
+
+static void printPoint(const ScalingPoint &point)
+{
+    cout << left << setw(8) << scalingName(point.scaling) << right
+         << setw(8) << point.threads
+         << setw(12) << point.particles
+         << setw(14) << fixed << setprecision(3) << point.median * 1e3
+         << setw(10) << setprecision(1) << 100 * point.stddev / point.mean << "%"
+         << setw(9) << point.samples
+         << setw(14) << setprecision(3) << point.particlesPerSecond * 1e-6
+         << setw(10) << setprecision(2) << point.speedup
+         << setw(11) << setprecision(1) << 100 * point.efficiency << "%" << endl;
+}
+
+static bool writeCsv(const string &path, const vector<ScalingPoint> &points)
+{
+    ofstream file(path);
+    if (!file)
+    {
+        cerr << "cannot write " << path << endl;
+        return false;
+    }
+    file << setprecision(10);
+    file << "scaling,threads,particles,samples,steps,mean_s,median_s,stddev_s,particles_per_second,speedup,efficiency,neighbor_list_builds\n";
+    for (const ScalingPoint &point : points)
+    {
+        file << scalingName(point.scaling) << "," << point.threads << "," << point.particles << ","
+             << point.samples << "," << point.steps << "," << point.mean << "," << point.median << ","
+             << point.stddev << "," << point.particlesPerSecond << "," << point.speedup << ","
+             << point.efficiency << "," << point.neighborListBuilds << "\n";
+    }
+    return (bool)file;
+}
+
+static bool writeJson(const string &path, const vector<ScalingPoint> &points, const ScalingOptions &options)
+{
+    ofstream file(path);
+    if (!file)
+    {
+        cerr << "cannot write " << path << endl;
+        return false;
+    }
+    char date[64];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    file << setprecision(10);
+    file << "{\n  \"context\": {\n"
+         << "    \"date\": \"" << date << "\",\n"
+         << "    \"num_cpus\": " << thread::hardware_concurrency() << ",\n"
+         << "    \"kernel_isa\": \"" << Kernel::isaName() << "\",\n"
+         << "    \"grid\": \"" << (options.gridType == GridType::Hash ? "hash" : "dense") << "\",\n"
+         << "    \"warmup_steps\": " << options.warmup << ",\n"
+         << "    \"steps_per_sample\": " << options.steps << ",\n"
+         << "    \"target_variation\": " << options.targetVariation << "\n"
+         << "  },\n  \"points\": [";
+    const char *separator = "\n";
+    for (const ScalingPoint &point : points)
+    {
+        file << separator << "    {\"scaling\": \"" << scalingName(point.scaling) << "\", "
+             << "\"threads\": " << point.threads << ", "
+             << "\"particles\": " << point.particles << ", "
+             << "\"samples\": " << point.samples << ", "
+             << "\"steps\": " << point.steps << ", "
+             << "\"mean_s\": " << point.mean << ", "
+             << "\"median_s\": " << point.median << ", "
+             << "\"stddev_s\": " << point.stddev << ", "
+             << "\"particles_per_second\": " << point.particlesPerSecond << ", "
+             << "\"speedup\": " << point.speedup << ", "
+             << "\"efficiency\": " << point.efficiency << ", "
+             << "\"neighbor_list_builds\": " << point.neighborListBuilds << "}";
+        separator = ",\n";
+    }
+    file << "\n  ]\n}\n";
+    return (bool)file;
+}
+
+static void printUsage(const char *program)
+{
+    cout << "usage: " << program << " [options]\n"
+         << "  --mode strong|weak|both  (default both)\n"
+         << "  --threads A,B,...        thread counts (default powers of two up to the hardware threads)\n"
+         << "  --particles N            strong scaling particle count (default 64000)\n"
+         << "  --particles-per-thread N weak scaling particles per thread (default 16000)\n"
+         << "  --warmup N               untimed steps per point (default 20)\n"
+         << "  --steps N                steps per sample (default 20)\n"
+         << "  --min-samples N          (default 3)\n"
+         << "  --max-samples N          (default 30)\n"
+         << "  --variation F            sample until stddev / mean is below F (default 0.02)\n"
+         << "  --grid hash|dense        grid backend (default dense)\n"
+         << "  --table-size N           hash grid table size\n"
+         << "  --csv PATH               write the points as CSV\n"
+         << "  --json PATH              write the points as JSON\n"
+         << "Particle counts are rounded to cubes, h, skin and mass scale with the spacing.\n";
+}
+
+static vector<int> parseList(const string &text)
+{
+    vector<int> values;
+    stringstream stream(text);
+    string item;
+    while (getline(stream, item, ','))
+        values.push_back(atoi(item.c_str()));
+    return values;
+}
+
+int main(int argc, char **argv)
+{
+    ScalingOptions options;
+    bool strong = true;
+    bool weak = true;
+    string csvPath;
+    string jsonPath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        auto value = [&]() -> const char *
+        {
+            if (i + 1 >= argc)
+            {
+                cerr << "missing value for " << arg << endl;
+                exit(1);
+            }
+            return argv[++i];
+        };
+        if (arg == "--mode")
+        {
+            string mode = value();
+            strong = mode == "strong" || mode == "both";
+            weak = mode == "weak" || mode == "both";
+            if (!strong && !weak)
+            {
+                cerr << "unknown mode " << mode << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--threads")
+            options.threads = parseList(value());
+        else if (arg == "--particles")
+            options.particles = (int)atof(value());
+        else if (arg == "--particles-per-thread")
+            options.particlesPerThread = (int)atof(value());
+        else if (arg == "--warmup")
+            options.warmup = atoi(value());
+        else if (arg == "--steps")
+            options.steps = max(atoi(value()), 1);
+        else if (arg == "--min-samples")
+            options.minSamples = max(atoi(value()), 2);
+        else if (arg == "--max-samples")
+            options.maxSamples = max(atoi(value()), 1);
+        else if (arg == "--variation")
+            options.targetVariation = (float)atof(value());
+        else if (arg == "--grid")
+        {
+            string type = value();
+            if (type == "hash")
+                options.gridType = GridType::Hash;
+            else if (type == "dense")
+                options.gridType = GridType::Dense;
+            else
+            {
+                cerr << "unknown grid " << type << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--table-size")
+            options.tableSize = atoi(value());
+        else if (arg == "--csv")
+            csvPath = value();
+        else if (arg == "--json")
+            jsonPath = value();
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            cerr << "unknown option " << arg << endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    int hardwareThreads = max((int)thread::hardware_concurrency(), 1);
+    if (options.threads.empty())
+    {
+        for (int t = 1; t < hardwareThreads; t *= 2)
+            options.threads.push_back(t);
+        options.threads.push_back(hardwareThreads);
+    }
+    for (int t : options.threads)
+    {
+        if (t < 1)
+        {
+            cerr << "thread counts must be positive" << endl;
+            return 1;
+        }
+        if (t > hardwareThreads)
+            cerr << "warning: " << t << " threads oversubscribe " << hardwareThreads << " hardware threads" << endl;
+    }
+
+    cout << "hardware threads: " << hardwareThreads << endl;
+    cout << "kernel: " << Kernel::isaName() << endl;
+    cout << left << setw(8) << "scaling" << right << setw(8) << "threads" << setw(12) << "particles"
+         << setw(14) << "ms/step" << setw(11) << "cv" << setw(9) << "samples"
+         << setw(14) << "Mparticles/s" << setw(10) << "speedup" << setw(12) << "efficiency" << endl;
+
+    vector<ScalingPoint> points;
+    for (Scaling scaling : {Scaling::Strong, Scaling::Weak})
+    {
+        if ((scaling == Scaling::Strong && !strong) || (scaling == Scaling::Weak && !weak))
+            continue;
+        vector<ScalingPoint> sweep;
+        for (int t : options.threads)
+        {
+            int n = scaling == Scaling::Strong ? options.particles : options.particlesPerThread * t;
+            sweep.push_back(measure(scaling, t, n, options));
+            computeEfficiency(sweep);
+            printPoint(sweep.back());
+        }
+        points.insert(points.end(), sweep.begin(), sweep.end());
+    }
+
+    if (!csvPath.empty() && !writeCsv(csvPath, points))
+        return 1;
+    if (!jsonPath.empty() && !writeJson(jsonPath, points, options))
+        return 1;
+    return 0;
+}
\ No newline at end of file
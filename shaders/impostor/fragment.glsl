@@ -0,0 +1,25 @@
+#version 450
+out vec3 color;
+in vec3 baseColor;
+in vec3 viewPosition;
+flat in vec3 viewCenter;
+in vec3 lightDirection;
+
+uniform mat4 projection;
+uniform float radius;
+
+void main(){
+     // intersect the ray from the camera through this fragment with the sphere
+     vec3 direction = normalize(viewPosition);
+     float b = dot(direction, viewCenter);
+     float discriminant = b * b - dot(viewCenter, viewCenter) + radius * radius;
+     if (discriminant < 0)
+          discard;
+     vec3 hit = direction * (b - sqrt(discriminant));
+     // same orientation as the icosphere shader, the normal points inwards
+     vec3 normal = (viewCenter - hit) / radius;
+     color = clamp(dot(lightDirection, normal), 0, 1) * baseColor;
+
+     vec4 clip = projection * vec4(hit, 1);
+     gl_FragDepth = (clip.z / clip.w) * 0.5 + 0.5;
+}
\ No newline at end of file
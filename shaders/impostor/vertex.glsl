@@ -0,0 +1,50 @@
+#version 450
+
+// instance position, quantized to [0, 1] over the simulation bounds
+in vec3 position;
+// density or speed, mapped to a color here
+in float value;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 lightDir;
+uniform vec3 boundsMin;
+uniform vec3 boundsSize;
+uniform float radius;
+uniform vec2 valueRange;
+out vec3 baseColor;
+out vec3 viewPosition;
+flat out vec3 viewCenter;
+out vec3 lightDirection;
+
+// green for low, red for high values
+vec3 colormap(float t) {
+    return vec3(t, 1 - t, 0);
+}
+
+void main(){
+    vec3 center = boundsMin + position * boundsSize;
+    viewCenter = (view * vec4(center, 1)).xyz;
+    // triangle strip corners (-1, -1), (1, -1), (-1, 1), (1, 1)
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2 - 1;
+    // the quad sits in the plane through the front of the sphere. Under perspective an off-axis silhouette
+    // is wider than the sphere, so the quad spans the slopes x / -z and y / -z of the planes through the eye
+    // that touch the sphere: s = (a w +- r sqrt(a^2 + w^2 - r^2)) / (w^2 - r^2) for center (a, -w).
+    // The fragment shader discards what the sphere doesn't cover
+    float depth = -viewCenter.z;
+    float front = depth - radius;
+    if (front > 0) {
+        float tangent = depth * depth - radius * radius;
+        vec2 slope = (viewCenter.xy * depth + corner * radius * sqrt(viewCenter.xy * viewCenter.xy + tangent)) / tangent;
+        viewPosition = vec3(slope * front, -front);
+    } else {
+        // the eye is inside the sphere's depth range, the near plane clips it anyway
+        viewPosition = viewCenter + vec3(corner * radius, radius);
+    }
+    gl_Position = projection * vec4(viewPosition, 1);
+
+    float t = clamp((value - valueRange.x) / (valueRange.y - valueRange.x), 0, 1);
+    baseColor = colormap(t);
+    // lighting is done in view space
+    lightDirection = normalize(mat3(view) * lightDir);
+}
\ No newline at end of file
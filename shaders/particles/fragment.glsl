@@ -1,4 +1,4 @@
-#version 460
+#version 450
 out vec3 color;
 in vec3 baseColor;
 in vec3 normal;
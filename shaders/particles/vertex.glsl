@@ -0,0 +1,36 @@
+#version 450
+
+in vec3 vertex;
+// instance position, quantized to [0, 1] over the simulation bounds
+in vec3 position;
+// density or speed, mapped to a color here
+in float value;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 lightDir;
+uniform vec3 boundsMin;
+uniform vec3 boundsSize;
+uniform float radius;
+uniform vec2 valueRange;
+out vec3 baseColor;
+out vec3 normal;
+out vec3 lightDirection;
+
+// green for low, red for high values
+vec3 colormap(float t) {
+    return vec3(t, 1 - t, 0);
+}
+
+void main(){
+    // particles are never rotated and uniformly scaled, so no model matrix is needed
+    vec3 center = boundsMin + position * boundsSize;
+    gl_Position = projection * view * vec4(center + vertex * radius, 1);
+
+    float t = clamp((value - valueRange.x) / (valueRange.y - valueRange.x), 0, 1);
+    baseColor = colormap(t);
+    // it's a sphere, so the normal is just the vertex
+    normal = -vertex;
+    // light direction stays in world space
+    lightDirection = normalize(lightDir);
+}
\ No newline at end of file
@@ -0,0 +1,293 @@
+#include "sharedMemoryTransport.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+static const uint64_t segmentMagic = 0x53504853484d454dull;
+// the segment starts with the header, every ring starts on a cache line
+static const size_t headerBytes = 128;
+
+struct SegmentHeader
+{
+    uint64_t magic;
+    uint64_t ringBytes;
+    uint32_t size;
+    // ranks that mapped the segment, rank 0 unlinks the name once all did
+    atomic<uint32_t> attached;
+    atomic<uint32_t> ready;
+};
+
+// both counters only grow and each is written by one side only
+struct SharedMemoryTransport::Ring
+{
+    alignas(64) atomic<uint64_t> written;
+    alignas(64) atomic<uint64_t> read;
+};
+
+static_assert(sizeof(SegmentHeader) <= headerBytes, "segment header too large");
+static_assert(atomic<uint64_t>::is_always_lock_free && atomic<uint32_t>::is_always_lock_free, "shared counters need lock-free atomics");
+
+/*
+Waits without progress: spins first, then gives the core away, then sleeps.
+Gives up after timeout seconds without progress.
+*/
+class Backoff
+{
+public:
+    Backoff(double timeout) : timeout(timeout), idle(0), since(chrono::steady_clock::now()) {}
+    void progress()
+    {
+        idle = 0;
+        since = chrono::steady_clock::now();
+    }
+    // false once the timeout passed
+    bool wait()
+    {
+        idle++;
+        if (idle < 64)
+            return true;
+        if (idle < 1024)
+            this_thread::yield();
+        else
+            this_thread::sleep_for(chrono::microseconds(50));
+        return (idle & 255) || chrono::duration<double>(chrono::steady_clock::now() - since).count() < timeout;
+    }
+
+private:
+    double timeout;
+    int idle;
+    chrono::steady_clock::time_point since;
+};
+
+SharedMemoryTransport::SharedMemoryTransport(const string &name, int rank, int size, size_t ringBytes, double timeout) : mapping(nullptr), mappingSize(0), linked(false)
+{
+    this->name = name;
+    this->rankIndex = rank;
+    this->rankCount = size;
+    this->ringBytes = (ringBytes + 63) / 64 * 64;
+    this->timeout = timeout;
+    if (!open() && mapping)
+    {
+#ifndef _WIN32
+        munmap(mapping, mappingSize);
+#endif
+        mapping = nullptr;
+    }
+}
+
+SharedMemoryTransport::~SharedMemoryTransport()
+{
+#ifndef _WIN32
+    if (linked)
+        shm_unlink(name.c_str());
+    if (mapping)
+        munmap(mapping, mappingSize);
+#endif
+}
+
+SharedMemoryTransport::Ring *SharedMemoryTransport::ring(int from, int to)
+{
+    size_t stride = sizeof(Ring) + ringBytes;
+    return reinterpret_cast<Ring *>(mapping + headerBytes + (size_t)(from * rankCount + to) * stride);
+}
+
+#ifndef _WIN32
+bool SharedMemoryTransport::open()
+{
+    if (rankIndex < 0 || rankIndex >= rankCount)
+    {
+        cerr << "rank " << rankIndex << " out of range for " << rankCount << " ranks" << endl;
+        return false;
+    }
+    mappingSize = headerBytes + (size_t)rankCount * rankCount * (sizeof(Ring) + ringBytes);
+    Backoff backoff(timeout);
+    int fd = -1;
+    if (rankIndex == 0)
+    {
+        // a segment left behind by a crashed run
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd == -1)
+        {
+            cerr << "cannot create shared memory " << name << ": " << strerror(errno) << endl;
+            return false;
+        }
+        linked = true;
+        // the new pages read as zero, every ring starts empty
+        if (ftruncate(fd, (off_t)mappingSize) != 0)
+        {
+            cerr << "cannot size shared memory " << name << ": " << strerror(errno) << endl;
+            ::close(fd);
+            return false;
+        }
+    }
+    else
+    {
+        // rank 0 may not have created or sized the segment yet
+        struct stat status;
+        while ((fd = shm_open(name.c_str(), O_RDWR, 0600)) == -1 || fstat(fd, &status) != 0 || (size_t)status.st_size < mappingSize)
+        {
+            if (fd != -1)
+                ::close(fd);
+            if (!backoff.wait())
+            {
+                cerr << "no shared memory " << name << " of the expected size, is rank 0 running with " << rankCount << " ranks?" << endl;
+                return false;
+            }
+        }
+    }
+    void *address = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED)
+    {
+        cerr << "cannot map shared memory " << name << ": " << strerror(errno) << endl;
+        return false;
+    }
+    mapping = static_cast<char *>(address);
+
+    SegmentHeader *header = reinterpret_cast<SegmentHeader *>(mapping);
+    if (rankIndex == 0)
+    {
+        header->magic = segmentMagic;
+        header->ringBytes = ringBytes;
+        header->size = rankCount;
+        header->ready.store(1, memory_order_release);
+        backoff.progress();
+        while (header->attached.load(memory_order_acquire) < (uint32_t)rankCount - 1)
+        {
+            if (!backoff.wait())
+            {
+                cerr << "only " << header->attached.load() + 1 << " of " << rankCount << " ranks attached to " << name << endl;
+                return false;
+            }
+        }
+        shm_unlink(name.c_str());
+        linked = false;
+        return true;
+    }
+    backoff.progress();
+    while (!header->ready.load(memory_order_acquire))
+    {
+        if (!backoff.wait())
+        {
+            cerr << "shared memory " << name << " never got ready" << endl;
+            return false;
+        }
+    }
+    if (header->magic != segmentMagic || header->size != (uint32_t)rankCount || header->ringBytes != ringBytes)
+    {
+        cerr << "shared memory " << name << " belongs to a different run" << endl;
+        return false;
+    }
+    header->attached.fetch_add(1, memory_order_acq_rel);
+    return true;
+}
+
+bool SharedMemoryTransport::exchange(const vector<int> &to, const vector<vector<char>> &outgoing,
+                                     const vector<int> &from, vector<vector<char>> &incoming)
+{
+    // every message is its 8 byte length, then its bytes
+    const size_t prefix = sizeof(uint64_t);
+    vector<size_t> sent(to.size(), 0);
+    vector<uint64_t> lengths(from.size(), 0);
+    vector<size_t> received(from.size(), 0);
+    incoming.assign(from.size(), vector<char>());
+    size_t remaining = to.size() + from.size();
+    Backoff backoff(timeout);
+    while (remaining > 0)
+    {
+        bool progress = false;
+        for (size_t k = 0; k < to.size(); k++)
+        {
+            uint64_t length = outgoing[k].size();
+            size_t total = prefix + length;
+            if (sent[k] == total)
+                continue;
+            Ring *r = ring(rankIndex, to[k]);
+            char *data = reinterpret_cast<char *>(r + 1);
+            uint64_t written = r->written.load(memory_order_relaxed);
+            size_t space = ringBytes - (size_t)(written - r->read.load(memory_order_acquire));
+            size_t put = 0;
+            while (put < space && sent[k] < total)
+            {
+                const char *source = sent[k] < prefix ? reinterpret_cast<const char *>(&length) + sent[k] : outgoing[k].data() + (sent[k] - prefix);
+                size_t available = sent[k] < prefix ? prefix - sent[k] : total - sent[k];
+                size_t offset = (size_t)((written + put) % ringBytes);
+                size_t piece = min({available, space - put, ringBytes - offset});
+                memcpy(data + offset, source, piece);
+                put += piece;
+                sent[k] += piece;
+            }
+            if (put == 0)
+                continue;
+            r->written.store(written + put, memory_order_release);
+            progress = true;
+            if (sent[k] == total)
+                remaining--;
+        }
+        for (size_t k = 0; k < from.size(); k++)
+        {
+            if (received[k] >= prefix && received[k] == prefix + lengths[k])
+                continue;
+            Ring *r = ring(from[k], rankIndex);
+            const char *data = reinterpret_cast<const char *>(r + 1);
+            uint64_t read = r->read.load(memory_order_relaxed);
+            size_t filled = (size_t)(r->written.load(memory_order_acquire) - read);
+            size_t got = 0;
+            while (got < filled && (received[k] < prefix || received[k] < prefix + lengths[k]))
+            {
+                char *target = received[k] < prefix ? reinterpret_cast<char *>(&lengths[k]) + received[k] : incoming[k].data() + (received[k] - prefix);
+                size_t wanted = received[k] < prefix ? prefix - received[k] : prefix + lengths[k] - received[k];
+                size_t offset = (size_t)((read + got) % ringBytes);
+                size_t piece = min({wanted, filled - got, ringBytes - offset});
+                memcpy(target, data + offset, piece);
+                got += piece;
+                received[k] += piece;
+                if (received[k] == prefix)
+                    incoming[k].resize(lengths[k]);
+            }
+            if (got == 0)
+                continue;
+            r->read.store(read + got, memory_order_release);
+            progress = true;
+            if (received[k] == prefix + lengths[k])
+                remaining--;
+        }
+        if (progress)
+            backoff.progress();
+        else if (!backoff.wait())
+        {
+            cerr << "rank " << rankIndex << ": no progress exchanging with its peers for " << timeout << " s" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+#else
+bool SharedMemoryTransport::open()
+{
+    cerr << "the shared memory transport needs POSIX shm_open" << endl;
+    return false;
+}
+
+bool SharedMemoryTransport::exchange(const vector<int> &to, const vector<vector<char>> &outgoing,
+                                     const vector<int> &from, vector<vector<char>> &incoming)
+{
+    return false;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+#include <stddef.h>
+#include <string>
+
+#include "transport.h"
+
+/*
+Transport between the processes of one machine through a POSIX shared memory segment.
+Every ordered pair of ranks has a single producer single consumer byte ring. Messages are
+streamed through it in pieces, so they may be larger than the ring.
+Waiting spins, then yields, then sleeps, so ranks sharing a core still make progress.
+*/
+class SharedMemoryTransport : public Transport
+{
+public:
+    /*
+    Rank 0 creates the segment name (e.g. "/sph-1234"), the other ranks attach to it.
+    The name is unlinked once every rank is attached, the memory goes away with the last process.
+    Every one of the size * size rings holds ringBytes. A peer that makes no progress for timeout seconds
+    counts as gone. Check isOpen, the reason of a failure is printed to cerr.
+    */
+    SharedMemoryTransport(const std::string &name, int rank, int size, size_t ringBytes = 1 << 20, double timeout = 60);
+    ~SharedMemoryTransport();
+    SharedMemoryTransport(const SharedMemoryTransport &) = delete;
+    SharedMemoryTransport &operator=(const SharedMemoryTransport &) = delete;
+    bool isOpen() const { return mapping != nullptr; }
+    int rank() const override { return rankIndex; }
+    int size() const override { return rankCount; }
+    bool exchange(const std::vector<int> &to, const std::vector<std::vector<char>> &outgoing,
+                  const std::vector<int> &from, std::vector<std::vector<char>> &incoming) override;
+
+private:
+    struct Ring;
+    std::string name;
+    int rankIndex;
+    int rankCount;
+    size_t ringBytes;
+    double timeout;
+    char *mapping;
+    size_t mappingSize;
+    // rank 0 still has to unlink the name
+    bool linked;
+    bool open();
+    // the ring from rank from to rank to, its bytes follow it
+    Ring *ring(int from, int to);
+};
\ No newline at end of file
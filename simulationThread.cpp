@@ -0,0 +1,92 @@
+#include "simulationThread.h"
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+
+using namespace std::chrono;
+
+static double wallTime()
+{
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+SimulationThread::SimulationThread(Fluid &fluid, float speed) : fluid(fluid), speed(speed), paused(false), running(true), measuredStepsPerSecond(0), acquiredAt(wallTime())
+{
+    // something to draw before the first step is done
+    exchange.back().capture(fluid);
+    exchange.publish();
+    acquire();
+    exchange.back().capture(fluid);
+    exchange.publish();
+    acquire();
+    thread = std::thread(&SimulationThread::run, this);
+}
+
+SimulationThread::~SimulationThread()
+{
+    running = false;
+    thread.join();
+}
+
+void SimulationThread::run()
+{
+    Profiler::global.setThreadName("simulation");
+    double last = wallTime();
+    // simulated time the solver should have reached
+    double target = fluid.getTime();
+    double rateStart = last;
+    int rateSteps = 0;
+    while (running)
+    {
+        double now = wallTime();
+        double elapsed = now - last;
+        last = now;
+        float currentSpeed = speed;
+        if (paused)
+        {
+            target = fluid.getTime();
+            std::this_thread::sleep_for(milliseconds(1));
+            continue;
+        }
+        if (currentSpeed > 0)
+        {
+            // don't try to catch up more than a tenth of a second of lag
+            target = std::min(target + elapsed * currentSpeed, fluid.getTime() + 0.1 * currentSpeed);
+            if (fluid.getTime() >= target)
+            {
+                std::this_thread::sleep_for(microseconds(500));
+                continue;
+            }
+        }
+        fluid.step();
+        {
+            SPH_PROFILE_SCOPE("snapshot");
+            exchange.back().capture(fluid);
+            exchange.publish();
+        }
+
+        rateSteps++;
+        if (now - rateStart > 0.5)
+        {
+            measuredStepsPerSecond = (float)(rateSteps / (now - rateStart));
+            rateStart = now;
+            rateSteps = 0;
+        }
+    }
+}
+
+void SimulationThread::acquire()
+{
+    if (exchange.acquire())
+        acquiredAt = wallTime();
+}
+
+float SimulationThread::interpolation() const
+{
+    double interval = current().time - previous().time;
+    float currentSpeed = speed;
+    if (interval <= 0 || currentSpeed <= 0)
+        return 1;
+    double alpha = (wallTime() - acquiredAt) * currentSpeed / interval;
+    return (float)std::min(std::max(alpha, 0.0), 1.0);
+}
\ No newline at end of file
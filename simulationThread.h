@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <thread>
+
+#include "fluid.h"
+#include "snapshot.h"
+
+/*
+Runs the solver on its own thread and publishes a snapshot after every step.
+The fluid must not be touched by anyone else while the thread is running.
+*/
+class SimulationThread
+{
+public:
+    // speed: simulated seconds per wall clock second, <= 0 runs as fast as possible
+    SimulationThread(Fluid &fluid, float speed = 1.0f);
+    ~SimulationThread();
+    void setSpeed(float speed) { this->speed = speed; }
+    float getSpeed() const { return speed; }
+    void setPaused(bool paused) { this->paused = paused; }
+    bool isPaused() const { return paused; }
+    /*
+    Take the newest snapshot for drawing, never blocks. Call from the render thread only.
+    */
+    void acquire();
+    const Snapshot &current() const { return exchange.current(); }
+    const Snapshot &previous() const { return exchange.previous(); }
+    /*
+    Where between previous() and current() the render time is, in [0, 1].
+    Drawing the interpolated state lags one snapshot behind but moves smoothly.
+    */
+    float interpolation() const;
+    // solver steps per wall clock second, measured on the simulation thread
+    float stepsPerSecond() const { return measuredStepsPerSecond; }
+
+private:
+    Fluid &fluid;
+    SnapshotExchange exchange;
+    std::atomic<float> speed;
+    std::atomic<bool> paused;
+    std::atomic<bool> running;
+    std::atomic<float> measuredStepsPerSecond;
+    double acquiredAt;
+    std::thread thread;
+    void run();
+};
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include "snapshot.h"
+#include "fluid.h"
+
+#include <cmath>
+
+void Snapshot::capture(const Fluid &fluid)
+{
+    const Particles &particles = fluid.getParticles();
+    int n = particles.size();
+    time = fluid.getTime();
+    dt = fluid.getLastTimeStep();
+    restDensity = fluid.getRestDensity();
+    hasDiagnostics = fluid.getDiagnostics(diagnostics);
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    density.resize(n);
+    speed.resize(n);
+    // in id order, the solver reorders its particles, interpolation needs the same particle at the same index
+    for (int i = 0; i < n; i++)
+    {
+        int id = particles.id[i];
+        x[id] = particles.x[i];
+        y[id] = particles.y[i];
+        z[id] = particles.z[i];
+        density[id] = particles.density[i];
+        speed[id] = std::sqrt(particles.vx[i] * particles.vx[i] + particles.vy[i] * particles.vy[i] + particles.vz[i] * particles.vz[i]);
+    }
+}
+
+SnapshotExchange::SnapshotExchange() : shared(0), backIndex(1), currentIndex(2), previousIndex(3)
+{
+}
+
+void SnapshotExchange::publish()
+{
+    backIndex = shared.exchange(backIndex | fresh, std::memory_order_acq_rel) & ~fresh;
+}
+
+bool SnapshotExchange::acquire()
+{
+    if (!(shared.load(std::memory_order_relaxed) & fresh))
+        return false;
+    // the old previous goes back into circulation, the old current becomes previous
+    int released = previousIndex;
+    previousIndex = currentIndex;
+    currentIndex = shared.exchange(released, std::memory_order_acq_rel) & ~fresh;
+    return true;
+}
\ No newline at end of file
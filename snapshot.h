@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "diagnostics.h"
+
+class Fluid;
+
+/*
+Copy of the particle state needed to draw one frame
+*/
+struct Snapshot
+{
+    double time = 0;
+    float dt = 0;
+    float restDensity = 0;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> density;
+    std::vector<float> speed;
+    // newest sample of the solver, if it took one yet
+    bool hasDiagnostics = false;
+    Diagnostics diagnostics;
+    void capture(const Fluid &fluid);
+    int size() const { return (int)x.size(); }
+    glm::vec3 position(int i) const { return glm::vec3(x[i], y[i], z[i]); }
+};
+
+/*
+Hands snapshots from one producer to one consumer without locks or waiting.
+Of the four buffers the producer owns one, the consumer owns two (current and previous,
+for interpolation) and one is shared. Publishing and acquiring swap the owned buffer
+with the shared one in a single atomic exchange.
+*/
+class SnapshotExchange
+{
+public:
+    SnapshotExchange();
+    // producer side: the buffer to fill, then publish it
+    Snapshot &back() { return buffers[backIndex]; }
+    void publish();
+    // consumer side: take the newest published snapshot if there is one, returns true if there was
+    bool acquire();
+    const Snapshot &current() const { return buffers[currentIndex]; }
+    const Snapshot &previous() const { return buffers[previousIndex]; }
+
+private:
+    static constexpr int fresh = 4;
+    Snapshot buffers[4];
+    // index of the shared buffer, | fresh if it holds a snapshot the consumer has not seen
+    std::atomic<int> shared;
+    int backIndex;
+    int currentIndex;
+    int previousIndex;
+};
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+/*
+Bounded lock-free queue for exactly one producer thread and one consumer thread.
+Neither side ever blocks: push fails when the queue is full, pop when it is empty.
+*/
+template <typename T>
+class SpscQueue
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscQueue(int capacity);
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+    // producer side, false if full
+    bool push(const T &value);
+    // consumer side, false if empty
+    bool pop(T &value);
+    int capacity() const { return (int)slots.size(); }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    // head and tail only ever grow, each is written by one side only and sits on its own cache line
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+template <typename T>
+SpscQueue<T>::SpscQueue(int capacity) : head(0), tail(0)
+{
+    size_t size = 1;
+    while (size < (size_t)capacity)
+        size *= 2;
+    slots.resize(size);
+    mask = size - 1;
+}
+
+template <typename T>
+bool SpscQueue<T>::push(const T &value)
+{
+    size_t next = tail.load(std::memory_order_relaxed);
+    if (next - head.load(std::memory_order_acquire) == slots.size())
+        return false;
+    slots[next & mask] = value;
+    tail.store(next + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool SpscQueue<T>::pop(T &value)
+{
+    size_t next = head.load(std::memory_order_relaxed);
+    if (next == tail.load(std::memory_order_acquire))
+        return false;
+    value = slots[next & mask];
+    head.store(next + 1, std::memory_order_release);
+    return true;
+}
\ No newline at end of file
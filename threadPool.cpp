@@ -0,0 +1,165 @@
+#include "threadPool.h"
+
+#include <string>
+
+#include "profiler.h"
+
+ThreadPool::ThreadPool(int threads) : currentJob(nullptr), phase(nullptr), phaseDepth(0), generation(0), pending(0), stopping(false)
+{
+    if (threads <= 0)
+        threads = (int)std::thread::hardware_concurrency();
+    if (threads <= 0)
+        threads = 1;
+    threadCount = threads;
+    taskRanges = std::vector<TaskRange>(threadCount);
+    for (int i = 1; i < threadCount; i++)
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+void ThreadPool::workerLoop(int threadIndex)
+{
+    long long seen = 0;
+#if SPH_PROFILE
+    bool named = false;
+#endif
+    while (true)
+    {
+        const std::function<void(int)> *job;
+#if SPH_PROFILE
+        const char *jobPhase;
+        int jobDepth;
+#endif
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]
+                      { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            job = currentJob;
+#if SPH_PROFILE
+            jobPhase = phase;
+            jobDepth = phaseDepth;
+#endif
+        }
+#if SPH_PROFILE
+        if (jobPhase && Profiler::global.countersEnabled())
+        {
+            if (!named)
+                Profiler::global.setThreadName(("worker " + std::to_string(threadIndex)).c_str());
+            named = true;
+            ProfileScope scope(jobPhase, jobDepth, true);
+            (*job)(threadIndex);
+        }
+        else
+#endif
+            (*job)(threadIndex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending--;
+        }
+        done.notify_one();
+    }
+}
+
+void ThreadPool::run(const std::function<void(int)> &job)
+{
+    if (threadCount == 1)
+    {
+        job(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        currentJob = &job;
+#if SPH_PROFILE
+        phase = ProfileScope::currentName();
+        phaseDepth = ProfileScope::currentDepth();
+#endif
+        pending = threadCount - 1;
+        generation++;
+    }
+    wake.notify_all();
+    job(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]
+              { return pending == 0; });
+}
+
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int, int, int)> &job)
+{
+    run([&](int threadIndex)
+        { job(chunkBegin(begin, end, threadIndex, threadCount), chunkBegin(begin, end, threadIndex + 1, threadCount), threadIndex); });
+}
+
+static uint64_t packRange(uint32_t begin, uint32_t end)
+{
+    return (uint64_t)end << 32 | begin;
+}
+
+bool ThreadPool::popTask(int threadIndex, int &task)
+{
+    std::atomic<uint64_t> &own = taskRanges[threadIndex].range;
+    uint64_t range = own.load(std::memory_order_acquire);
+    while (true)
+    {
+        uint32_t begin = (uint32_t)range;
+        uint32_t end = (uint32_t)(range >> 32);
+        if (begin >= end)
+            return false;
+        if (own.compare_exchange_weak(range, packRange(begin + 1, end), std::memory_order_acq_rel))
+        {
+            task = (int)begin;
+            return true;
+        }
+    }
+}
+
+bool ThreadPool::stealTasks(int threadIndex)
+{
+    for (int offset = 1; offset < threadCount; offset++)
+    {
+        std::atomic<uint64_t> &victim = taskRanges[(threadIndex + offset) % threadCount].range;
+        uint64_t range = victim.load(std::memory_order_acquire);
+        while (true)
+        {
+            uint32_t begin = (uint32_t)range;
+            uint32_t end = (uint32_t)(range >> 32);
+            if (begin >= end)
+                break;
+            uint32_t split = end - (end - begin + 1) / 2;
+            if (victim.compare_exchange_weak(range, packRange(begin, split), std::memory_order_acq_rel))
+            {
+                // our own range is empty, so nobody else writes it concurrently
+                taskRanges[threadIndex].range.store(packRange(split, end), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ThreadPool::parallelForDynamic(int tasks, const std::function<void(int, int)> &job)
+{
+    for (int t = 0; t < threadCount; t++)
+        taskRanges[t].range.store(packRange(chunkBegin(0, tasks, t, threadCount), chunkBegin(0, tasks, t + 1, threadCount)));
+    run([&](int threadIndex)
+        {
+        int task;
+        do
+        {
+            while (popTask(threadIndex, task))
+                job(task, threadIndex);
+        } while (stealTasks(threadIndex)); });
+}
\ No newline at end of file
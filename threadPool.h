@@ -0,0 +1,63 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Fixed set of worker threads that run one job on every thread at a time.
+The calling thread takes part as thread 0.
+parallelForDynamic balances uneven tasks by work stealing.
+*/
+class ThreadPool
+{
+public:
+    // threads <= 0 uses one thread per hardware thread
+    ThreadPool(int threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    int size() const { return threadCount; }
+    /*
+    Call job(threadIndex) once on every thread and wait for all of them
+    */
+    void run(const std::function<void(int)> &job);
+    /*
+    Split [begin, end) into one contiguous chunk per thread and call job(chunkBegin, chunkEnd, threadIndex).
+    Chunk boundaries only depend on the range and the thread count.
+    */
+    void parallelFor(int begin, int end, const std::function<void(int, int, int)> &job);
+    /*
+    Call job(task, threadIndex) for every task in [0, tasks).
+    Every thread starts on its own contiguous share of the tasks and takes them from the front,
+    a thread that runs out steals the back half of another thread's remaining share.
+    */
+    void parallelForDynamic(int tasks, const std::function<void(int, int)> &job);
+    static int chunkBegin(int begin, int end, int chunk, int chunks) { return begin + (int)((long long)(end - begin) * chunk / chunks); }
+
+private:
+    int threadCount;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int)> *currentJob;
+    // profiler scope the job was started from, the workers count their share into it
+    const char *phase;
+    int phaseDepth;
+    long long generation;
+    int pending;
+    bool stopping;
+    // remaining task range of every thread, begin in the low and end in the high 32 bits
+    struct alignas(64) TaskRange
+    {
+        std::atomic<uint64_t> range;
+    };
+    std::vector<TaskRange> taskRanges;
+    void workerLoop(int threadIndex);
+    bool popTask(int threadIndex, int &task);
+    bool stealTasks(int threadIndex);
+};
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "trajectory.h"
+
+#include <string.h>
+#include <iostream>
+
+using namespace std;
+
+TrajectoryWriter::TrajectoryWriter(const string &path, int particleCount, const TrajectoryOptions &options)
+    : path(path), particleCount(particleCount), options(options), failed(false), steps(0), recorded(0), dropped(0), written(0), bytes(0),
+      filled(options.queueCapacity), empty(options.queueCapacity), signaled(false), stopping(false)
+{
+    this->options.stride = max(this->options.stride, 1);
+    this->options.keyframeInterval = max(this->options.keyframeInterval, 1);
+    file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        cerr << "Can't open " << path << endl;
+        return;
+    }
+    TrajectoryFileHeader header = {};
+    memcpy(header.magic, trajectoryMagic, sizeof(trajectoryMagic));
+    header.version = trajectoryVersion;
+    header.particleCount = particleCount;
+    header.stride = this->options.stride;
+    header.keyframeInterval = this->options.keyframeInterval;
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        cerr << "Can't write " << path << endl;
+        fclose(file);
+        file = nullptr;
+        return;
+    }
+    bytes = sizeof(header);
+
+    // all frame buffers are allocated up front, recording only reuses them
+    for (int i = 0; i < options.queueCapacity; i++)
+    {
+        frames.push_back(make_unique<Frame>());
+        frames.back()->values.resize((size_t)trajectoryComponents * particleCount);
+        empty.push(frames.back().get());
+    }
+    thread = std::thread(&TrajectoryWriter::run, this);
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+    close();
+}
+
+bool TrajectoryWriter::close()
+{
+    if (!file)
+        return !failed;
+    signal(true);
+    thread.join();
+    // fclose writes out what is still buffered
+    failed = fclose(file) != 0 || failed;
+    file = nullptr;
+    if (failed)
+        cerr << "Can't write " << path << ", the trajectory is incomplete" << endl;
+    return !failed;
+}
+
+void TrajectoryWriter::signal(bool stop)
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        signaled = true;
+        stopping = stopping || stop;
+    }
+    wake.notify_one();
+}
+
+void TrajectoryWriter::record(const Fluid &fluid)
+{
+    if (!file || steps++ % options.stride != 0)
+        return;
+    recorded++;
+    const Particles &particles = fluid.getParticles();
+    Frame *frame;
+    if (particles.size() != particleCount || !empty.pop(frame))
+    {
+        dropped++;
+        return;
+    }
+
+    frame->header = {};
+    frame->header.step = steps - 1;
+    frame->header.time = fluid.getTime();
+    const float *components[trajectoryComponents] = {
+        particles.x.data(), particles.y.data(), particles.z.data(),
+        particles.vx.data(), particles.vy.data(), particles.vz.data(),
+        particles.density.data()};
+    for (int c = 0; c < trajectoryComponents; c++)
+    {
+        const float *values = components[c];
+        float lo = particleCount > 0 ? values[0] : 0;
+        float hi = lo;
+        for (int i = 0; i < particleCount; i++)
+        {
+            lo = min(lo, values[i]);
+            hi = max(hi, values[i]);
+        }
+        frame->header.min[c] = lo;
+        frame->header.max[c] = hi;
+        float scale = hi > lo ? 65535 / (hi - lo) : 0;
+        uint16_t *quantized = frame->values.data() + (size_t)c * particleCount;
+        // in id order, so the deltas between frames are per particle
+        const int *ids = particles.id.data();
+        for (int i = 0; i < particleCount; i++)
+            quantized[ids[i]] = (uint16_t)min((values[i] - lo) * scale + 0.5f, 65535.0f);
+    }
+    // there are as many slots as frames, so this never fails
+    filled.push(frame);
+    signal(false);
+}
+
+// signed difference to an unsigned number that is small when the difference is small
+static uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+bool TrajectoryWriter::write(const Frame &frame, vector<uint16_t> &previous, vector<uint8_t> &payload)
+{
+    bool keyframe = written % options.keyframeInterval == 0;
+    if (keyframe)
+        fill(previous.begin(), previous.end(), 0);
+    payload.clear();
+    for (size_t i = 0; i < frame.values.size(); i++)
+    {
+        uint32_t value = zigzag((int32_t)frame.values[i] - (int32_t)previous[i]);
+        while (value >= 0x80)
+        {
+            payload.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        payload.push_back((uint8_t)value);
+    }
+    previous = frame.values;
+
+    TrajectoryFrameHeader header = frame.header;
+    header.payloadSize = payload.size();
+    header.keyframe = keyframe;
+    if (fwrite(&header, sizeof(header), 1, file) != 1 || fwrite(payload.data(), 1, payload.size(), file) != payload.size())
+        return false;
+    bytes += sizeof(header) + payload.size();
+    written++;
+    return true;
+}
+
+void TrajectoryWriter::run()
+{
+    vector<uint16_t> previous((size_t)trajectoryComponents * particleCount, 0);
+    vector<uint8_t> payload;
+    while (true)
+    {
+        Frame *frame;
+        if (filled.pop(frame))
+        {
+            // after a failed write the frames are only handed back, close reports the failure
+            if (!failed)
+                failed = !write(*frame, previous, payload);
+            empty.push(frame);
+            continue;
+        }
+        // every push is signaled after it, so once a signal is taken the queue is tried again before waiting,
+        // and stopping without a signal left means every frame was written
+        unique_lock<std::mutex> lock(mutex);
+        if (!signaled && stopping)
+            break;
+        wake.wait(lock, [&]
+                  { return signaled; });
+        signaled = false;
+    }
+}
+
+TrajectoryReader::TrajectoryReader(const string &path) : header()
+{
+    file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        cerr << "Can't open " << path << endl;
+        return;
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, trajectoryMagic, sizeof(trajectoryMagic)) != 0 || header.version > trajectoryVersion || header.particleCount < 0)
+    {
+        cerr << path << " is not a trajectory" << endl;
+        fclose(file);
+        file = nullptr;
+        return;
+    }
+    previous.assign((size_t)trajectoryComponents * header.particleCount, 0);
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+    if (file)
+        fclose(file);
+}
+
+bool TrajectoryReader::next(TrajectoryFrame &frame)
+{
+    TrajectoryFrameHeader frameHeader;
+    if (!file || fread(&frameHeader, sizeof(frameHeader), 1, file) != 1)
+        return false;
+    payload.resize(frameHeader.payloadSize);
+    if (fread(payload.data(), 1, payload.size(), file) != payload.size())
+        return false;
+
+    if (frameHeader.keyframe)
+        fill(previous.begin(), previous.end(), 0);
+    size_t position = 0;
+    for (size_t i = 0; i < previous.size(); i++)
+    {
+        uint32_t value = 0;
+        for (int shift = 0;; shift += 7)
+        {
+            if (position >= payload.size() || shift > 28)
+                return false;
+            uint8_t byte = payload[position++];
+            value |= (uint32_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        previous[i] = (uint16_t)(previous[i] + unzigzag(value));
+    }
+
+    frame.step = frameHeader.step;
+    frame.time = frameHeader.time;
+    frame.keyframe = frameHeader.keyframe != 0;
+    vector<float> *components[trajectoryComponents] = {&frame.x, &frame.y, &frame.z, &frame.vx, &frame.vy, &frame.vz, &frame.density};
+    int n = header.particleCount;
+    for (int c = 0; c < trajectoryComponents; c++)
+    {
+        float lo = frameHeader.min[c];
+        float step = (frameHeader.max[c] - lo) / 65535;
+        components[c]->resize(n);
+        const uint16_t *quantized = previous.data() + (size_t)c * n;
+        for (int i = 0; i < n; i++)
+            (*components[c])[i] = lo + quantized[i] * step;
+    }
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,155 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fluid.h"
+#include "spscQueue.h"
+
+/*
+Trajectory file: a TrajectoryFileHeader, then one TrajectoryFrameHeader and payload per recorded frame.
+
+Every frame stores trajectoryComponents values per particle (x, y, z, vx, vy, vz, density),
+each quantized to 16 bit fixed point relative to the frame's bounding box of that component:
+value = min + q * (max - min) / 65535. The payload holds the components one after the other;
+each value is the difference to the same value in the previous frame (to 0 in keyframes),
+zigzag mapped and written as a LEB128 varint, so slowly moving particles take one byte.
+*/
+constexpr char trajectoryMagic[8] = {'S', 'P', 'H', 'T', 'R', 'A', 'J', 0};
+constexpr uint32_t trajectoryVersion = 1;
+constexpr int trajectoryComponents = 7;
+
+struct TrajectoryFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t particleCount;
+    int32_t stride;
+    int32_t keyframeInterval;
+};
+
+struct TrajectoryFrameHeader
+{
+    // bytes of varints following the header
+    uint64_t payloadSize;
+    uint64_t step;
+    double time;
+    uint32_t keyframe;
+    uint32_t reserved;
+    float min[trajectoryComponents];
+    float max[trajectoryComponents];
+};
+
+struct TrajectoryOptions
+{
+    // record every stride-th step
+    int stride = 10;
+    // written frames between frames that don't depend on the previous one
+    int keyframeInterval = 100;
+    // frames that may wait for the writer, frames beyond that are dropped
+    int queueCapacity = 8;
+};
+
+/*
+Decoded frame, see TrajectoryReader
+*/
+struct TrajectoryFrame
+{
+    uint64_t step = 0;
+    double time = 0;
+    bool keyframe = false;
+    std::vector<float> x, y, z;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> density;
+};
+
+/*
+Records quantized frames on the solver thread and compresses and writes them on a background thread,
+which sleeps on a condition variable while there is nothing to write.
+record never blocks on the disk: if the writer falls behind by queueCapacity frames, frames are dropped
+(and counted) instead. The following frames still decode, deltas are always to the previous written frame.
+*/
+class TrajectoryWriter
+{
+public:
+    TrajectoryWriter(const std::string &path, int particleCount, const TrajectoryOptions &options = TrajectoryOptions());
+    ~TrajectoryWriter();
+    TrajectoryWriter(const TrajectoryWriter &) = delete;
+    TrajectoryWriter &operator=(const TrajectoryWriter &) = delete;
+    bool isOpen() const { return file != nullptr; }
+    /*
+    Call after every step, records every stride-th call. Call from one thread only.
+    */
+    void record(const Fluid &fluid);
+    /*
+    Write the queued frames and close the file, called by the destructor.
+    Returns false and prints the reason if any write failed.
+    */
+    bool close();
+    int framesRecorded() const { return recorded; }
+    int framesDropped() const { return dropped; }
+    int framesWritten() const { return written; }
+    uint64_t bytesWritten() const { return bytes; }
+
+private:
+    struct Frame
+    {
+        TrajectoryFrameHeader header;
+        // component major, particleCount values per component
+        std::vector<uint16_t> values;
+    };
+    std::string path;
+    int particleCount;
+    TrajectoryOptions options;
+    FILE *file;
+    // set by the writer thread, read once it is joined
+    bool failed;
+    uint64_t steps;
+    int recorded;
+    int dropped;
+    std::atomic<int> written;
+    std::atomic<uint64_t> bytes;
+    std::vector<std::unique_ptr<Frame>> frames;
+    // filled frames to the writer, and empty ones back
+    SpscQueue<Frame *> filled;
+    SpscQueue<Frame *> empty;
+    // wakes the writer after a push or for stopping
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool signaled;
+    bool stopping;
+    std::thread thread;
+    void signal(bool stop);
+    void run();
+    // false if the file could not be written
+    bool write(const Frame &frame, std::vector<uint16_t> &previous, std::vector<uint8_t> &payload);
+};
+
+/*
+Reads trajectory files frame by frame
+*/
+class TrajectoryReader
+{
+public:
+    TrajectoryReader(const std::string &path);
+    ~TrajectoryReader();
+    TrajectoryReader(const TrajectoryReader &) = delete;
+    TrajectoryReader &operator=(const TrajectoryReader &) = delete;
+    bool isOpen() const { return file != nullptr; }
+    int particleCount() const { return header.particleCount; }
+    int stride() const { return header.stride; }
+    // decode the next frame, false at the end of the file or on a damaged frame
+    bool next(TrajectoryFrame &frame);
+
+private:
+    FILE *file;
+    TrajectoryFileHeader header;
+    std::vector<uint16_t> previous;
+    std::vector<uint8_t> payload;
+};
\ No newline at end of file
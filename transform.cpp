@@ -0,0 +1,16 @@
+#include "transform.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace glm;
+
+mat4 Transform::getMatrix()
+{
+    mat4 model = mat4(1.0f);
+    model = glm::scale(model, scale);
+    model = rotate(model, radians(rotation.x), vec3(1, 0, 0));
+    model = rotate(model, radians(rotation.y), vec3(0, 1, 0));
+    model = rotate(model, radians(rotation.z), vec3(0, 0, 1));
+    translate(model, position);
+    return model;
+}
\ No newline at end of file
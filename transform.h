@@ -0,0 +1,11 @@
+#pragma once
+#include <glm/glm.hpp>
+
+struct Transform
+{
+    glm::vec3 position;
+    glm::vec3 rotation; // euler angles in degrees
+    glm::vec3 scale;
+    Transform(glm::vec3 position = glm::vec3(0), glm::vec3 rotation = glm::vec3(0), glm::vec3 scale = glm::vec3(1)) : position(position), rotation(rotation), scale(scale){};
+    glm::mat4 getMatrix();
+};
\ No newline at end of file
@@ -0,0 +1,28 @@
+#include "transport.h"
+
+using namespace std;
+
+bool Transport::allGather(const vector<char> &message, vector<vector<char>> &messages)
+{
+    vector<int> others;
+    for (int r = 0; r < size(); r++)
+    {
+        if (r != rank())
+            others.push_back(r);
+    }
+    vector<vector<char>> outgoing(others.size(), message);
+    vector<vector<char>> incoming;
+    if (!exchange(others, outgoing, others, incoming))
+        return false;
+    messages.resize(size());
+    for (int k = 0; k < (int)others.size(); k++)
+        messages[others[k]].swap(incoming[k]);
+    messages[rank()] = message;
+    return true;
+}
+
+bool Transport::barrier()
+{
+    vector<vector<char>> messages;
+    return allGather(vector<char>(), messages);
+}
\ No newline at end of file
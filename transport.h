@@ -0,0 +1,25 @@
+#pragma once
+#include <vector>
+
+/*
+Message passing between the processes of a decomposed run, one rank per process.
+A backend only has to implement exchange, the collectives are built on top of it.
+*/
+class Transport
+{
+public:
+    virtual ~Transport() {}
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+    /*
+    Send outgoing[k] to rank to[k] and receive one message from every rank of from into incoming[k],
+    progressing all of them at once so two ranks may send each other more than fits in flight.
+    Messages between two ranks arrive in order, so both sides must make matching exchanges.
+    Returns false with the reason on cerr if a peer is gone or stopped responding.
+    */
+    virtual bool exchange(const std::vector<int> &to, const std::vector<std::vector<char>> &outgoing,
+                          const std::vector<int> &from, std::vector<std::vector<char>> &incoming) = 0;
+    // the message of every rank, indexed by rank and including this one
+    bool allGather(const std::vector<char> &message, std::vector<std::vector<char>> &messages);
+    bool barrier();
+};
\ No newline at end of file